@@ -0,0 +1,121 @@
+#include "AEADWrapper.h"
+#include "RNGWrapper.h"
+
+#include <aes.h>
+#include <gcm.h>
+#include <chachapoly.h>
+#include <hkdf.h>
+#include <sha.h>
+#include <cpu.h>
+#include <misc.h>
+
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+
+
+namespace
+{
+	const char GCM_INFO[] = "mmn15 aes-128-gcm";
+	const char CHACHA_INFO[] = "mmn15 chacha20-poly1305";
+
+	void deriveKey(unsigned char* out, unsigned int outLength, const unsigned char* key, unsigned int length, const char* info, size_t infoLength)
+	{
+		CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+		hkdf.DeriveKey(out, outLength, key, length, NULL, 0, reinterpret_cast<const CryptoPP::byte*>(info), infoLength);
+	}
+}
+
+
+AEADWrapper::Suite AEADWrapper::PreferredSuite()
+{
+#if (CRYPTOPP_BOOL_X86 || CRYPTOPP_BOOL_X32 || CRYPTOPP_BOOL_X64)
+	static const bool hardwareGCM = CryptoPP::HasAESNI() && CryptoPP::HasCLMUL();
+#elif (CRYPTOPP_BOOL_ARM32 || CRYPTOPP_BOOL_ARMV8)
+	static const bool hardwareGCM = CryptoPP::HasAES() && CryptoPP::HasPMULL();
+#else
+	static const bool hardwareGCM = false;
+#endif
+	return hardwareGCM ? AES_GCM : CHACHA20_POLY1305;
+}
+
+AEADWrapper::AEADWrapper(const unsigned char* key, unsigned int length) : AEADWrapper(key, length, PreferredSuite())
+{
+}
+
+AEADWrapper::AEADWrapper(const unsigned char* key, unsigned int length, Suite suite) : _suite(suite)
+{
+	if (length != DEFAULT_KEYLENGTH)
+		throw std::length_error("key length must be 16 bytes");
+	deriveKey(_gcmKey, GCM_KEYLENGTH, key, length, GCM_INFO, sizeof(GCM_INFO) - 1);
+	deriveKey(_chachaKey, CHACHA_KEYLENGTH, key, length, CHACHA_INFO, sizeof(CHACHA_INFO) - 1);
+}
+
+AEADWrapper::~AEADWrapper()
+{
+	CryptoPP::SecureWipeArray(_gcmKey, GCM_KEYLENGTH);
+	CryptoPP::SecureWipeArray(_chachaKey, CHACHA_KEYLENGTH);
+}
+
+AEADWrapper::Suite AEADWrapper::getSuite() const
+{
+	return _suite;
+}
+
+std::string AEADWrapper::encrypt(const char* plain, unsigned int length) const
+{
+	std::string cipher(OVERHEAD + length, '\0');
+	CryptoPP::byte* out = reinterpret_cast<CryptoPP::byte*>(&cipher[0]);
+	CryptoPP::byte* nonce = out + 1;
+	CryptoPP::byte* body = nonce + NONCE_SIZE;
+
+	out[0] = _suite;	// authenticated as associated data
+	RNGWrapper::GenerateBlock(nonce, NONCE_SIZE);
+
+	std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> e;
+	if (_suite == AES_GCM)
+	{
+		e.reset(new CryptoPP::GCM<CryptoPP::AES>::Encryption);
+		e->SetKeyWithIV(_gcmKey, GCM_KEYLENGTH, nonce, NONCE_SIZE);
+	}
+	else
+	{
+		e.reset(new CryptoPP::ChaCha20Poly1305::Encryption);
+		e->SetKeyWithIV(_chachaKey, CHACHA_KEYLENGTH, nonce, NONCE_SIZE);
+	}
+	e->EncryptAndAuthenticate(body, body + length, TAG_SIZE, nonce, NONCE_SIZE,
+		out, 1, reinterpret_cast<const CryptoPP::byte*>(plain), length);
+	return cipher;
+}
+
+std::string AEADWrapper::decrypt(const char* cipher, unsigned int length) const
+{
+	if (length < OVERHEAD)
+		throw std::length_error("aead message is too short");
+
+	const CryptoPP::byte* in = reinterpret_cast<const CryptoPP::byte*>(cipher);
+	const CryptoPP::byte* nonce = in + 1;
+	const CryptoPP::byte* body = nonce + NONCE_SIZE;
+	const unsigned int bodyLength = length - OVERHEAD;
+
+	std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> d;
+	if (in[0] == AES_GCM)
+	{
+		d.reset(new CryptoPP::GCM<CryptoPP::AES>::Decryption);
+		d->SetKeyWithIV(_gcmKey, GCM_KEYLENGTH, nonce, NONCE_SIZE);
+	}
+	else if (in[0] == CHACHA20_POLY1305)
+	{
+		d.reset(new CryptoPP::ChaCha20Poly1305::Decryption);
+		d->SetKeyWithIV(_chachaKey, CHACHA_KEYLENGTH, nonce, NONCE_SIZE);
+	}
+	else
+		throw std::runtime_error("unknown aead suite");
+
+	std::string decrypted(bodyLength, '\0');
+	bool ok = d->DecryptAndVerify(reinterpret_cast<CryptoPP::byte*>(&decrypted[0]), body + bodyLength, TAG_SIZE,
+		nonce, NONCE_SIZE, in, 1, body, bodyLength);
+	if (!ok)
+		throw std::runtime_error("aead message failed authentication");
+	return decrypted;
+}
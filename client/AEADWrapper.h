@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+
+// authenticated encryption for message content (single pass, no separate MAC).
+// the suite is picked from the cpu: AES-GCM when AES-NI/PCLMUL are there, ChaCha20-Poly1305 otherwise.
+// encrypt() output, which is also the content of a MSG_AEAD_TEXT message:
+//     suite (1 byte) | nonce (12 bytes) | ciphertext | tag (16 bytes)
+// decrypt() reads the suite from the content, so both suites can always be read.
+// encrypt/decrypt keep no cipher state between calls and may be used from several threads.
+class AEADWrapper
+{
+public:
+	enum Suite : unsigned char
+	{
+		AES_GCM = 1,
+		CHACHA20_POLY1305 = 2
+	};
+
+	static const unsigned int DEFAULT_KEYLENGTH = 16;	// same session key as AESWrapper
+	static const unsigned int NONCE_SIZE = 12;
+	static const unsigned int TAG_SIZE = 16;
+	static const unsigned int OVERHEAD = 1 + NONCE_SIZE + TAG_SIZE;
+
+private:
+	static const unsigned int GCM_KEYLENGTH = 16;
+	static const unsigned int CHACHA_KEYLENGTH = 32;
+
+	Suite _suite;
+	unsigned char _gcmKey[GCM_KEYLENGTH];		// per suite keys derived from the session key
+	unsigned char _chachaKey[CHACHA_KEYLENGTH];
+
+	AEADWrapper(const AEADWrapper& aead);
+	AEADWrapper& operator=(const AEADWrapper& aead);
+public:
+	static Suite PreferredSuite();
+
+	AEADWrapper(const unsigned char* key, unsigned int length);
+	AEADWrapper(const unsigned char* key, unsigned int length, Suite suite);
+	~AEADWrapper();
+
+	Suite getSuite() const;
+
+	std::string encrypt(const char* plain, unsigned int length) const;
+	std::string decrypt(const char* cipher, unsigned int length) const;
+};
@@ -1,18 +1,16 @@
 #include "AESWrapper.h"
+#include "RNGWrapper.h"
 
 #include <modes.h>
 #include <aes.h>
 #include <filters.h>
 
 #include <stdexcept>
-#include <immintrin.h>	// _rdrand32_step
 
 
 unsigned char* AESWrapper::GenerateKey(unsigned char* buffer, unsigned int length)
 {
-	for (size_t i = 0; i < length; i += sizeof(unsigned int))
-		_rdrand32_step(reinterpret_cast<unsigned int*>(&buffer[i]));
-	return buffer;
+	return RNGWrapper::GenerateBlock(buffer, length);
 }
 
 AESWrapper::AESWrapper()
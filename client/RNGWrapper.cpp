@@ -0,0 +1,52 @@
+#include "RNGWrapper.h"
+
+#include <secblock.h>
+
+#include <cstring>
+
+
+namespace
+{
+	struct ThreadRNG
+	{
+		CryptoPP::AutoSeededRandomPool drbg;	// seeded from the OS once per thread
+		CryptoPP::SecByteBlock buffer;
+		size_t offset;
+
+		ThreadRNG() : buffer(RNGWrapper::BUFFER_SIZE), offset(RNGWrapper::BUFFER_SIZE) {}
+	};
+
+	ThreadRNG& threadRNG()
+	{
+		thread_local ThreadRNG rng;
+		return rng;
+	}
+}
+
+
+CryptoPP::RandomNumberGenerator& RNGWrapper::GetRNG()
+{
+	return threadRNG().drbg;
+}
+
+unsigned char* RNGWrapper::GenerateBlock(unsigned char* buffer, unsigned int length)
+{
+	ThreadRNG& rng = threadRNG();
+
+	// big requests go straight to the DRBG, small ones (keys, nonces) are cut from the buffer
+	if (length > BUFFER_SIZE / 4)
+	{
+		rng.drbg.GenerateBlock(buffer, length);
+		return buffer;
+	}
+
+	if (rng.buffer.size() - rng.offset < length)
+	{
+		rng.drbg.GenerateBlock(rng.buffer, rng.buffer.size());
+		rng.offset = 0;
+	}
+	memcpy(buffer, rng.buffer + rng.offset, length);
+	memset(rng.buffer + rng.offset, 0, length);	// handed out key material is not kept around
+	rng.offset += length;
+	return buffer;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <osrng.h>
+
+
+// process-wide random source shared by the crypto wrappers.
+// every thread lazily gets its own auto-seeded DRBG, so creating a wrapper
+// no longer reseeds a pool from the OS.
+class RNGWrapper
+{
+public:
+	static const unsigned int BUFFER_SIZE = 1024;	// key material pre-generated per thread
+
+private:
+	RNGWrapper();
+public:
+	static CryptoPP::RandomNumberGenerator& GetRNG();
+	static unsigned char* GenerateBlock(unsigned char* buffer, unsigned int length);
+};
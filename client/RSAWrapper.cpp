@@ -1,4 +1,5 @@
 #include "RSAWrapper.h"
+#include "RNGWrapper.h"
 
 
 RSAPublicWrapper::RSAPublicWrapper(const char* key, unsigned int length)
@@ -36,7 +37,7 @@ std::string RSAPublicWrapper::encrypt(const std::string& plain)
 {
 	std::string cipher;
 	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
-	CryptoPP::StringSource ss(plain, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	CryptoPP::StringSource ss(plain, true, new CryptoPP::PK_EncryptorFilter(RNGWrapper::GetRNG(), e, new CryptoPP::StringSink(cipher)));
 	return cipher;
 }
 
@@ -44,7 +45,7 @@ std::string RSAPublicWrapper::encrypt(const char* plain, unsigned int length)
 {
 	std::string cipher;
 	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
-	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(plain), length, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(plain), length, true, new CryptoPP::PK_EncryptorFilter(RNGWrapper::GetRNG(), e, new CryptoPP::StringSink(cipher)));
 	return cipher;
 }
 
@@ -52,7 +53,7 @@ std::string RSAPublicWrapper::encrypt(const char* plain, unsigned int length)
 
 RSAPrivateWrapper::RSAPrivateWrapper()
 {
-	_privateKey.Initialize(_rng, BITS);
+	_privateKey.Initialize(RNGWrapper::GetRNG(), BITS);
 }
 
 RSAPrivateWrapper::RSAPrivateWrapper(const char* key, unsigned int length)
@@ -107,7 +108,7 @@ std::string RSAPrivateWrapper::decrypt(const std::string& cipher)
 {
 	std::string decrypted;
 	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
-	CryptoPP::StringSource ss_cipher(cipher, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
+	CryptoPP::StringSource ss_cipher(cipher, true, new CryptoPP::PK_DecryptorFilter(RNGWrapper::GetRNG(), d, new CryptoPP::StringSink(decrypted)));
 	return decrypted;
 }
 
@@ -115,6 +116,6 @@ std::string RSAPrivateWrapper::decrypt(const char* cipher, unsigned int length)
 {
 	std::string decrypted;
 	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
-	CryptoPP::StringSource ss_cipher(reinterpret_cast<const CryptoPP::byte*>(cipher), length, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
+	CryptoPP::StringSource ss_cipher(reinterpret_cast<const CryptoPP::byte*>(cipher), length, true, new CryptoPP::PK_DecryptorFilter(RNGWrapper::GetRNG(), d, new CryptoPP::StringSink(decrypted)));
 	return decrypted;
 }
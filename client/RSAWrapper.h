@@ -1,6 +1,5 @@
 #pragma once
 
-#include <osrng.h>
 #include <rsa.h>
 
 #include <string>
@@ -14,7 +13,6 @@ public:
 	static const unsigned int BITS = 1024;
 
 private:
-	CryptoPP::AutoSeededRandomPool _rng;
 	CryptoPP::RSA::PublicKey _publicKey;
 
 	RSAPublicWrapper(const RSAPublicWrapper& rsapublic);
@@ -39,7 +37,6 @@ public:
 	static const unsigned int BITS = 1024;
 
 private:
-	CryptoPP::AutoSeededRandomPool _rng;
 	CryptoPP::RSA::PrivateKey _privateKey;
 
 	RSAPrivateWrapper(const RSAPrivateWrapper& rsaprivate);
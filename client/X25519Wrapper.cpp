@@ -0,0 +1,153 @@
+#include "X25519Wrapper.h"
+#include "RNGWrapper.h"
+
+#include <aes.h>
+#include <gcm.h>
+#include <hkdf.h>
+#include <sha.h>
+#include <misc.h>
+
+#include <stdexcept>
+#include <cstring>
+
+
+namespace
+{
+	const unsigned int WRAP_KEYLENGTH = 16;
+	const unsigned int WRAP_IVLENGTH = 12;
+	const char WRAP_INFO[] = "mmn15 x25519 key wrap";
+
+	// the wrapping key is used exactly once (fresh ephemeral key every time), so a zero iv is safe
+	const CryptoPP::byte WRAP_IV[WRAP_IVLENGTH] = { 0 };
+
+	void deriveWrapKey(CryptoPP::byte* out, const CryptoPP::byte* shared, const CryptoPP::byte* ephemeralPublic, const CryptoPP::byte* recipientPublic)
+	{
+		CryptoPP::byte salt[2 * X25519PublicWrapper::KEYSIZE];
+		memcpy(salt, ephemeralPublic, X25519PublicWrapper::KEYSIZE);
+		memcpy(salt + X25519PublicWrapper::KEYSIZE, recipientPublic, X25519PublicWrapper::KEYSIZE);
+
+		CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+		hkdf.DeriveKey(out, WRAP_KEYLENGTH, shared, CryptoPP::x25519::SHARED_KEYLENGTH,
+			salt, sizeof(salt), reinterpret_cast<const CryptoPP::byte*>(WRAP_INFO), sizeof(WRAP_INFO) - 1);
+	}
+}
+
+
+X25519PublicWrapper::X25519PublicWrapper(const char* key, unsigned int length)
+{
+	if (length != KEYSIZE)
+		throw std::length_error("x25519 public key must be 32 bytes");
+	memcpy(_publicKey, key, KEYSIZE);
+}
+
+X25519PublicWrapper::X25519PublicWrapper(const std::string& key) : X25519PublicWrapper(key.data(), static_cast<unsigned int>(key.size()))
+{
+}
+
+X25519PublicWrapper::~X25519PublicWrapper()
+{
+}
+
+std::string X25519PublicWrapper::getPublicKey() const
+{
+	return std::string(reinterpret_cast<const char*>(_publicKey), KEYSIZE);
+}
+
+std::string X25519PublicWrapper::encrypt(const std::string& plain)
+{
+	return encrypt(plain.data(), static_cast<unsigned int>(plain.size()));
+}
+
+std::string X25519PublicWrapper::encrypt(const char* plain, unsigned int length)
+{
+	CryptoPP::x25519 ecdh;
+	CryptoPP::SecByteBlock ephemeralPrivate(CryptoPP::x25519::SECRET_KEYLENGTH);
+	CryptoPP::byte ephemeralPublic[KEYSIZE];
+	ecdh.GenerateKeyPair(RNGWrapper::GetRNG(), ephemeralPrivate, ephemeralPublic);
+
+	CryptoPP::SecByteBlock shared(CryptoPP::x25519::SHARED_KEYLENGTH);
+	if (!ecdh.Agree(shared, ephemeralPrivate, _publicKey))
+		throw std::runtime_error("x25519 key agreement failed");
+
+	CryptoPP::SecByteBlock wrapKey(WRAP_KEYLENGTH);
+	deriveWrapKey(wrapKey, shared, ephemeralPublic, _publicKey);
+
+	std::string cipher(KEYSIZE + length + TAGSIZE, '\0');
+	CryptoPP::byte* out = reinterpret_cast<CryptoPP::byte*>(&cipher[0]);
+	memcpy(out, ephemeralPublic, KEYSIZE);
+
+	CryptoPP::GCM<CryptoPP::AES>::Encryption gcm;
+	gcm.SetKeyWithIV(wrapKey, WRAP_KEYLENGTH, WRAP_IV, WRAP_IVLENGTH);
+	gcm.EncryptAndAuthenticate(out + KEYSIZE, out + KEYSIZE + length, TAGSIZE, WRAP_IV, WRAP_IVLENGTH,
+		NULL, 0, reinterpret_cast<const CryptoPP::byte*>(plain), length);
+	return cipher;
+}
+
+
+
+X25519PrivateWrapper::X25519PrivateWrapper()
+{
+	CryptoPP::x25519 ecdh;
+	ecdh.GenerateKeyPair(RNGWrapper::GetRNG(), _privateKey, _publicKey);
+}
+
+X25519PrivateWrapper::X25519PrivateWrapper(const char* key, unsigned int length)
+{
+	if (length != KEYSIZE)
+		throw std::length_error("x25519 private key must be 32 bytes");
+	memcpy(_privateKey, key, KEYSIZE);
+
+	CryptoPP::x25519 ecdh;
+	ecdh.GeneratePublicKey(RNGWrapper::GetRNG(), _privateKey, _publicKey);
+}
+
+X25519PrivateWrapper::X25519PrivateWrapper(const std::string& key) : X25519PrivateWrapper(key.data(), static_cast<unsigned int>(key.size()))
+{
+}
+
+X25519PrivateWrapper::~X25519PrivateWrapper()
+{
+	CryptoPP::SecureWipeArray(_privateKey, KEYSIZE);
+}
+
+std::string X25519PrivateWrapper::getPrivateKey() const
+{
+	return std::string(reinterpret_cast<const char*>(_privateKey), KEYSIZE);
+}
+
+std::string X25519PrivateWrapper::getPublicKey() const
+{
+	return std::string(reinterpret_cast<const char*>(_publicKey), KEYSIZE);
+}
+
+std::string X25519PrivateWrapper::decrypt(const std::string& cipher)
+{
+	return decrypt(cipher.data(), static_cast<unsigned int>(cipher.size()));
+}
+
+std::string X25519PrivateWrapper::decrypt(const char* cipher, unsigned int length)
+{
+	if (length < KEYSIZE + X25519PublicWrapper::TAGSIZE)
+		throw std::length_error("x25519 wrapped key is too short");
+
+	const CryptoPP::byte* in = reinterpret_cast<const CryptoPP::byte*>(cipher);
+	const unsigned int plainLength = length - KEYSIZE - X25519PublicWrapper::TAGSIZE;
+
+	CryptoPP::x25519 ecdh;
+	CryptoPP::SecByteBlock shared(CryptoPP::x25519::SHARED_KEYLENGTH);
+	if (!ecdh.Agree(shared, _privateKey, in))
+		throw std::runtime_error("x25519 key agreement failed");
+
+	CryptoPP::SecByteBlock wrapKey(WRAP_KEYLENGTH);
+	deriveWrapKey(wrapKey, shared, in, _publicKey);
+
+	std::string decrypted(plainLength, '\0');
+	CryptoPP::GCM<CryptoPP::AES>::Decryption gcm;
+	gcm.SetKeyWithIV(wrapKey, WRAP_KEYLENGTH, WRAP_IV, WRAP_IVLENGTH);
+	bool ok = gcm.DecryptAndVerify(reinterpret_cast<CryptoPP::byte*>(&decrypted[0]),
+		in + KEYSIZE + plainLength, X25519PublicWrapper::TAGSIZE, WRAP_IV, WRAP_IVLENGTH,
+		NULL, 0, in + KEYSIZE, plainLength);
+	if (!ok)
+		throw std::runtime_error("x25519 wrapped key failed authentication");
+	return decrypted;
+}
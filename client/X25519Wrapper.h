@@ -0,0 +1,58 @@
+#pragma once
+
+#include <xed25519.h>
+
+#include <string>
+
+
+// X25519 counterpart of RSAWrapper.
+// encrypt() wraps a short secret (a symmetric key) for the key owner: a fresh ephemeral
+// key pair is agreed with the recipient key, and the derived one-time key seals the
+// secret with AES-GCM. output = ephemeral public key | ciphertext | tag.
+class X25519PublicWrapper
+{
+public:
+	static const unsigned int KEYSIZE = 32;
+	static const unsigned int TAGSIZE = 16;
+
+private:
+	CryptoPP::byte _publicKey[KEYSIZE];
+
+	X25519PublicWrapper(const X25519PublicWrapper& x25519public);
+	X25519PublicWrapper& operator=(const X25519PublicWrapper& x25519public);
+public:
+
+	X25519PublicWrapper(const char* key, unsigned int length);
+	X25519PublicWrapper(const std::string& key);
+	~X25519PublicWrapper();
+
+	std::string getPublicKey() const;
+
+	std::string encrypt(const std::string& plain);
+	std::string encrypt(const char* plain, unsigned int length);
+};
+
+
+class X25519PrivateWrapper
+{
+public:
+	static const unsigned int KEYSIZE = 32;
+
+private:
+	CryptoPP::byte _privateKey[KEYSIZE];
+	CryptoPP::byte _publicKey[KEYSIZE];
+
+	X25519PrivateWrapper(const X25519PrivateWrapper& x25519private);
+	X25519PrivateWrapper& operator=(const X25519PrivateWrapper& x25519private);
+public:
+	X25519PrivateWrapper();
+	X25519PrivateWrapper(const char* key, unsigned int length);
+	X25519PrivateWrapper(const std::string& key);
+	~X25519PrivateWrapper();
+
+	std::string getPrivateKey() const;
+	std::string getPublicKey() const;
+
+	std::string decrypt(const std::string& cipher);
+	std::string decrypt(const char* cipher, unsigned int length);
+};
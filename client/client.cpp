@@ -12,262 +12,228 @@
 #include <string>
 #include <vector>
 #include "client_ui.h" 
-#include <fstream>
+#include <sstream>
 #include <functional>
 #include <thread>
 #include <cstddef>
 #include "utils.h"
 #include "Base64Wrapper.h"
-#include "encryption.h"
+#include "clientApi.h"
+#include "daemon.h"
 
 
 using namespace std;  
 
 //===========================
-// handle request from user ui (code 1xx)
+// console commands (code 1xx) on top of the client library (clientApi.h)
 //===========================
 
-// handle the different requests based on user input
-void handle_request(int option, ClientSession& session) {
-    if (option == 110) {  // register user option
-        string username;
-        cout << "Enter username for registration: ";
-        getline(cin, session.username);
-        bool existing_id = user_in_file(session.username);
+// the result of every operation is printed by its completion handler on the session strand,
+// the render thread keeps the lines of concurrent results apart
 
-        if (existing_id == true) {
-            cout << "User already registered "<< endl;
-            return;
-        }
-        
-        // generate key pair
-        session.rsaPrivate = std::make_unique<RSAPrivateWrapper>();
-        session.rsaPrivateKey = Base64Wrapper::encode(session.rsaPrivate->getPrivateKey());
-        session.rsaPublicKey = session.rsaPrivate->getPublicKey();
+static void show_error(const boost::system::error_code& ec) {
+    display_err(ec.category() == client_category() ? ec.message() : "Client encountered an error: " + ec.message());
+}
 
-        string base64_public_key = Base64Wrapper::encode(session.rsaPublicKey);
-        // create binary packet for registration request
-        vector<uint8_t> packet = create_registration_packet(session.username, base64_public_key);
-        send_data(session.socket, packet);  // send registration request to server
+// shows decrypted pulled messages
+static void display_pulled_messages(const vector<PulledMessage>& messages) {
+    for (const PulledMessage& msg : messages) {
+        string sender_name = get_username_by_id(msg.sender_id);
+        display_message("From: " + sender_name);
+        display_message("Content: " + msg.message_content);
+        display_message("-----<EOM>-----");
     }
-    else if (option == 120) { //users list
-        if (session.client_id.empty()) {
-            cerr << "Error: Client ID is not set. Please register first.\n";
-            return;
-        }
-        vector<uint8_t> packet = create_get_users_packet(session.client_id);
-        send_data(session.socket, packet);
+}
 
+static void on_sent(const boost::system::error_code& ec, uint32_t) {
+    if (ec) {
+        show_error(ec);
+        return;
     }
-    else if (option == 130) {  // public key request
-        string recipient_username;
-        cout << "Enter recipient username: ";
-        getline(cin, recipient_username);
+    display_message("message sent");
+}
 
-        string recipient_id = get_id_by_username(recipient_username);
-        if (recipient_id.empty()) {
-            cerr << "Error: recipient not found in file.\n";
-            return;
+// starts the operation for one command, returns false for exit
+bool run_command(const UserCommand& command, MessageClient& client) {
+    int option = command.option;
+    if (option == 110) {  // register user option
+        if (user_in_file(command.target)) {
+            // registered before (this or an earlier run): restore id, keys and cached session keys
+            string username = command.target;
+            client.async_login(username, [username](const boost::system::error_code& ec, size_t cached) {
+                if (ec) {
+                    show_error(ec);
+                    return;
+                }
+                display_message("User already registered, logged in as " + username
+                    + " (" + to_string(cached) + " cached session keys)");
+            });
+            return true;
         }
-
-        vector<uint8_t> packet = create_get_public_key_packet(session.client_id, recipient_id);
-        send_data(session.socket, packet);
+        client.async_register_user(command.target, [](const boost::system::error_code& ec, ClientId) {
+            if (ec) {
+                show_error(ec);
+                return;
+            }
+            display_message("Registration success!");
+        });
     }
-    else if (option == 140) {  // get waiting messages
-        if (session.client_id.empty()) {
-            cerr << "Error: Client ID is not set. Please register first.\n";
-            return;
-        }
-        vector<uint8_t> packet = create_pull_messages_packet(session.client_id);
-        send_data(session.socket, packet);
+    else if (option == 120) {  // users list
+        client.async_list_users([](const boost::system::error_code& ec, vector<UserInfo> users) {
+            if (ec) {
+                show_error(ec);
+                return;
+            }
+            vector<string> user_list;
+            for (const UserInfo& user : users) {
+                user_list.push_back(user.username);
+            }
+            display_user_list(user_list);
+        });
     }
-    else if (option == 150) {  // send message op
-        if (session.client_id.empty()) {
-            cerr << "Error: Client ID is not set. Please register first.\n";
-            return;
+    else if (option == 130) {  // public key request
+        ClientId recipient_id = get_id_by_username(command.target);
+        if (recipient_id.empty()) {
+            display_err("recipient not found in file.");
+            return true;
         }
-        string recipient, message;
-        cout << "Enter recipient's username: " << endl;
-        getline(cin, recipient);
-        string recipient_id = get_id_by_username(recipient);
+        client.async_get_public_key(recipient_id, [](const boost::system::error_code& ec, string) {
+            if (ec) {
+                show_error(ec);
+                return;
+            }
+            display_message("Received public key for client ");
+        });
+    }
+    else if (option == 140) {  // get waiting messages, shown a batch at a time while they arrive
+        client.async_pull_messages([](vector<PulledMessage> batch) {
+            display_pulled_messages(batch);
+        }, [](const boost::system::error_code& ec, size_t pulled) {
+            if (ec) {
+                show_error(ec);
+            }
+            else if (pulled == 0) {
+                display_message("No new messages.");
+            }
+        });
+    }
+    else if (option == 150 || option == 151 || option == 152) {  // messages to one user
+        ClientId recipient_id = get_id_by_username(command.target);
         if (recipient_id.empty()) {
             display_err("Recipient not found in local info");
-            return;
+            return true;
+        }
+        if (option == 151) {  // ask the recipient for a symmetric key (type 1)
+            client.async_request_symmetric_key(recipient_id, on_sent);
+        }
+        else if (option == 152) {  // send our symmetric key, wrapped with the recipient's public key (type 2)
+            client.async_send_symmetric_key(recipient_id, on_sent);
+        }
+        else {  // send text (type 5)
+            client.async_send_message(recipient_id, command.text, on_sent);
         }
-        cout << "Enter your message: " << endl;
-        getline(cin, message);
-
-        // binary packet for sending message
-        uint8_t m_type = 3;
-        vector<uint8_t> packet = create_message_packet(session.client_id, recipient_id, message, m_type);
-        send_data(session.socket, packet);  // Send message to server
     }
-
+    else if (option == 160) {  // send one message to several users
+        vector<ClientId> recipient_ids;
+        stringstream names(command.target);
+        string name;
+        while (getline(names, name, ',')) {
+            name.erase(0, name.find_first_not_of(' '));
+            name.erase(name.find_last_not_of(' ') + 1);
+            if (name.empty()) {
+                continue;
+            }
+            ClientId recipient_id = get_id_by_username(name);
+            if (recipient_id.empty()) {
+                display_err("Recipient " + name + " not found in local info");
+                return true;
+            }
+            recipient_ids.push_back(recipient_id);
+        }
+        if (recipient_ids.empty()) {
+            display_err("No recipients given");
+            return true;
+        }
+        client.async_send_message(recipient_ids, command.text, on_sent);
+    }
     else if (option == 0) {
-        cout << "Exiting client. Releasing resources..." << endl;
-        close_connection(session.socket);  
-        exit(0);  // terminate the program
+        display_message("Exiting client. Releasing resources...");
+        return false;
     }
     else {
         display_err("Invalid option selected.");
     }
+    return true;
 }
 
 
-//===========================
-// handle request from server (code 2xxx)
-//===========================
-
-
-// getting response(raw header and payload) from read_response function and handle it
-void handle_response(ClientSession& session, const Response& resp) {
-    const ResponseHeader& h = resp.header;
-
-    // for demonstration, convert client_id to hex or just print
-    //cout << "Version: " << (int)h.version << "\n";
-    //cout << "Code:    " << h.code << "\n";
-    //cout << "Payload: " << h.payload_size << " bytes\n";
-
-    switch (h.code) {
-    case 2100: { // registration success
-        // 16 bytes of new client ID in payload
-        if (resp.payload.size() < 16) {
-            cerr << "Error: incomplete client ID in payload\n";
-            return;
-        }
-
-        string clientID(resp.payload.begin(), resp.payload.begin() + 16);
-        cout << "Registration success!" << "\n";
-        // add user id to session
-        session.client_id = clientID;
-
-        // save username and client ID to "my.info"
-        ofstream myInfoFile("my.info", ios::app);;
-        if (myInfoFile.is_open()) {
-            myInfoFile << session.username << "\n";
-            myInfoFile << clientID << "\n";
-            myInfoFile << session.rsaPrivateKey << "\n";
-            myInfoFile.close();
-            //cout << "Saved registration info to my.info with id " << session.client_id << "\n";
-        }
-        else {
-            cerr << "Error: Could not open my.info for writing.\n";
-        }
-        break;
-    }
-    case 2101: {  //user list
-        // each user record is 16 bytes for user_id + 255 bytes for username = 271 bytes.
-        size_t record_size = 16 + 255; // 271 bytes per record.
-        if (resp.payload.size() % record_size != 0) {
-            cerr << "Error: Payload size is not a multiple of " << record_size << " bytes.\n";
-            return;
-        }
-        size_t num_users = resp.payload.size() / record_size;
-        vector<string> user_list;
-        for (size_t i = 0; i < num_users; i++) {
-            size_t offset = i * record_size;
-            // skip the first 16 bytes (user ID), and read the next 255 bytes for username.
-            string username(resp.payload.begin() + offset + 16,
-                resp.payload.begin() + offset + record_size);
-            // dealing null characters.
-            size_t null_pos = username.find('\0');
-            if (null_pos != string::npos) {
-                username = username.substr(0, null_pos);
+//sending input and receiving data from user
+// input and console output run on their own threads, requests run on the session's
+// io thread, so responses are handled while the user is typing.
+void client_function(MessageClient& client) {
+    CommandQueue commands;
+    Wakeup command_pushed, command_popped;
+    start_renderer();
+
+    thread input([&commands, &command_pushed, &command_popped]() {
+        while (true) {
+            UserCommand command = read_user_command();
+            wait_until(command_popped, [&]() { return commands.push(command); });  // command thread is behind
+            command_pushed.notify();
+            if (command.option == 0) {
+                break;
             }
-            user_list.push_back(username);
         }
-        // display the user list.
-        //cout << "for user: " << session.client_id << " display users list" << "\n";
-        display_user_list(user_list); 
-        break;
-    }
-    case 2102: {  // public key response
-        if (resp.payload.size() < 16) {
-            cerr << "Payload too small for public key response\n";
-            return;
+    });
+
+    bool running = true;
+    while (running) {
+        UserCommand command;
+        wait_until(command_pushed, [&]() { return commands.pop(command); });  // sleeps while the user types
+        command_popped.notify();
+        try {
+            running = run_command(command, client);
+        }
+        catch (const std::exception& e) {
+            display_err("Client encountered an error: " + string(e.what()));
         }
-        string recipient_id(resp.payload.begin(), resp.payload.begin() + 16);
-        string public_key(resp.payload.begin() + 16, resp.payload.end());
-        known_public_keys[recipient_id] = public_key;
-        cout << "Received public key for client " << endl;
-        //cout << public_key << endl;
-
-        break;
     }
 
-    case 2103: {  //message sent reponse
-        display_message("message sent");
-        break;
-    }
-    case 2104: {  //pull messages response
-        if (resp.payload.empty()) {
-            display_message("No new messages.");
-            break;
-        }
+    input.join();
+    stop_renderer();
+}
 
-        size_t offset = 0;
-        while (offset < resp.payload.size()) {
-            // Parse each message
-            string sender_id(resp.payload.begin() + offset, resp.payload.begin() + offset + 16);
-            offset += 16;
-            uint32_t message_id = (resp.payload[offset] << 24) | (resp.payload[offset + 1] << 16) |
-                (resp.payload[offset + 2] << 8) | resp.payload[offset + 3];
-            offset += 4;
-            uint8_t message_type = resp.payload[offset];
-            offset += 1;
-            uint32_t content_size = (resp.payload[offset] << 24) | (resp.payload[offset + 1] << 16) |
-                (resp.payload[offset + 2] << 8) | resp.payload[offset + 3];
-            offset += 4;
-            string message_content(resp.payload.begin() + offset, resp.payload.begin() + offset + content_size);
-            offset += content_size;
 
-            string sender_name = get_username_by_id(sender_id);
-            display_message("From: " + sender_name);
-            display_message("Content: " + message_content);
-            display_message("-----<EOM>-----");
 
-        }
-        break;
+// headless mode, serves local apps (daemon.h) until SIGINT / SIGTERM
+int daemon_function(SessionManager& manager, MessageClient& client, const string& username, const string& socket_path) {
+    try {
+        client.async_login(username, boost::asio::use_future).get();
     }
-    case 9000: {
-        display_message("General error occurred on the server.");
-        break;
-    }        
-    default:
-        cout << "Unknown response code: " << h.code << "\n";
-        break;
+    catch (const boost::system::system_error&) {
+        cerr << "daemon: " << username << " is not registered in my.info, register with the console first" << endl;
+        return 1;
     }
-}
-
-
-//sending input and receiving data from user
-void client_function(const string& server_ip, int server_port, ClientSession &session) {
+    Daemon daemon(client, socket_path);
     try {
-        
-        while (true) {
-
-            connect_to_server(session.socket, server_ip, server_port);
-            
-            int usr_input = get_user_input();
-
-            handle_request(usr_input, session);
-
-            Response resp = read_response(session.socket);
-            //cout << "response from server was read ... " << "\n";
-            handle_response(session, resp);
-            //cout << "response handled successfuly " << "\n";
-        }
+        daemon.start();
     }
     catch (const std::exception& e) {
-        display_err("Client encountered an error: " + string(e.what()));
+        cerr << "daemon: could not listen on " << socket_path << ": " << e.what() << endl;
+        return 1;
     }
+    cout << "daemon: serving " << username << " on " << socket_path << endl;
+    daemon.wait();
+    manager.stop();  // nothing may run on the daemon once it is gone
+    return 0;
 }
 
 
+// usage: client                                  console
+//        client --daemon <username> [socket path]  headless, see daemon.h
+int main(int argc, char* argv[]) {
+    bool daemon_mode = argc >= 3 && string(argv[1]) == "--daemon";
 
-int main() {
-
-    
     config cfg;
     cfg.load_file("server.info");
 
@@ -276,21 +242,31 @@ int main() {
     int server_port = cfg.get_port();
 
 
-    // create and launch multiple client threads
-    vector<thread> client_threads;
-
-    boost::asio::io_context io_context;  // each client gets its own io_context
-    ClientSession session(io_context);  // each client gets its own socket
-
-    client_threads.push_back(std::thread([&]() {client_function(server_ip, server_port, session);
-        }));
-
-    // wait for all client threads to finish
-    for (auto& t : client_threads) {
-        t.join();
+    // the console drives one session, the manager can host many more (see sessionManager.h)
+    SessionManager manager(1);
+    try {
+        manager.set_server(server_ip, server_port);
+    }
+    catch (const std::exception& e) {
+        display_err("Could not resolve server: " + string(e.what()));
+        return 1;
+    }
+    shared_ptr<ClientSession> session = manager.create_session();
+    if (cfg.get_max_frame_size() > 0) {
+        session->frames.set_max_frame_size(cfg.get_max_frame_size());
     }
 
-    
+    int result = 0;
+    {
+        MessageClient client(manager, session);
+        if (daemon_mode) {
+            result = daemon_function(manager, client, argv[2], argc >= 4 ? argv[3] : "client.sock");
+        }
+        else {
+            client_function(client);
+        }
+        manager.stop();  // operations still running are dropped
+    }
 
-    return 0;
+    return result;
 }
@@ -4,31 +4,15 @@
 #include <boost/asio.hpp>  
 #include <string>
 #include "config.h"
-#include "network.h"  
-#include "RSAWrapper.h"
+#include "clientApi.h"
+#include "threadQueues.h"
 using boost::asio::ip::tcp;
 using namespace std;
 
-class ClientSession {
-public:
-    std::string username; // holds the username entered by the user.
-    std::string client_id; // holds id the assigned from registration
-    tcp::socket socket;
-    std::unique_ptr<RSAPrivateWrapper> rsaPrivate;
-    std::string rsaPublicKey;
-    std::string rsaPrivateKey;
+bool run_command(const UserCommand& command, MessageClient& client);
 
-    // constructor: initializes the socket with the io_context.
-    ClientSession(boost::asio::io_context& io_context)
-        : socket(io_context) {}
-};
+void client_function(MessageClient& client);
 
-std::string get_id_by_username(const std::string& username);
-
-void handle_request(int option, ClientSession& session);
-
-void handle_response(ClientSession& session, const Response& resp);
-
-void client_function(const string& server_ip, int server_port, ClientSession& session);
+int daemon_function(SessionManager& manager, MessageClient& client, const std::string& username, const std::string& socket_path);
 
 #endif  // CLIENT_H
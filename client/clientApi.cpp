@@ -0,0 +1,369 @@
+// client library: protocol requests as async operations on one session
+
+#include "clientApi.h"
+#include <stdexcept>
+#include "encryption.h"
+#include "utils.h"
+
+using namespace std;
+
+
+namespace {
+    class ClientCategory : public boost::system::error_category {
+    public:
+        const char* name() const noexcept override { return "client"; }
+
+        string message(int ev) const override {
+            switch (static_cast<ClientError>(ev)) {
+            case ClientError::server_error: return "General error occurred on the server.";
+            case ClientError::not_registered: return "Client ID is not set. Please register first.";
+            case ClientError::no_public_key: return "No public key for this user. Request it (130) first.";
+            case ClientError::no_session_key: return "No symmetric key for this user. Send one (152) or request one (151) first.";
+            case ClientError::bad_response: return "Unexpected response from the server.";
+            case ClientError::no_saved_user: return "Could not load user from my.info.";
+            case ClientError::user_not_saved: return "Registered, but could not write my.info. The user can't log in again.";
+            }
+            return "Unknown client error";
+        }
+    };
+}
+
+const boost::system::error_category& client_category() {
+    static ClientCategory category;
+    return category;
+}
+
+boost::system::error_code make_error_code(ClientError e) {
+    return boost::system::error_code(static_cast<int>(e), client_category());
+}
+
+// transport errors as they are, 9000 and anything but the expected code as client errors
+static boost::system::error_code check_response(const boost::system::error_code& ec, const Response& resp, uint16_t expected) {
+    if (ec) {
+        return ec;
+    }
+    if (resp.header.code == 9000) {
+        return ClientError::server_error;
+    }
+    if (resp.header.code != expected) {
+        return ClientError::bad_response;
+    }
+    return boost::system::error_code();
+}
+
+
+MessageClient::MessageClient(SessionManager& manager, shared_ptr<ClientSession> session)
+    : _manager(manager), _session(move(session)), _busy(false) {}
+
+// the files and the key pair are read on the calling thread, only the session fields are set on the strand
+void MessageClient::login(const string& username, CountHandler done) {
+    ClientId client_id;
+    string private_key;
+    shared_ptr<unique_ptr<KeyPair>> keys = make_shared<unique_ptr<KeyPair>>();
+    if (load_user_from_file(username, client_id, private_key)) {
+        try {
+            *keys = make_unique<KeyPair>(private_key);
+        }
+        catch (const exception&) {
+            // damaged key, reported below
+        }
+    }
+    size_t cached = *keys ? load_session_keys(client_id, **keys) : 0;
+
+    start([this, username, client_id, keys, cached, done]() {
+        if (!*keys) {
+            done(ClientError::no_saved_user, 0);
+            return;
+        }
+        _session->username = username;
+        _session->client_id = client_id;
+        _session->keys = move(*keys);
+        done(boost::system::error_code(), cached);
+    });
+}
+
+//===========================
+// request queue: one exchange at a time per session, in start order
+//===========================
+
+// every operation runs on the strand, posted in the order the caller started them
+void MessageClient::start(function<void()> operation) {
+    boost::asio::post(_session->strand, move(operation));
+}
+
+// runs on the session strand
+void MessageClient::request(vector<uint8_t> packet, ResponseHandler done, PulledMessageHandler on_message,
+    UserRecordHandler on_user) {
+    _pending.push_back(PendingRequest{ move(packet), move(done), move(on_message), move(on_user) });
+    if (!_busy) {
+        run_next();
+    }
+}
+
+// runs on the session strand
+void MessageClient::run_next() {
+    if (_pending.empty()) {
+        _busy = false;
+        return;
+    }
+    _busy = true;
+    PendingRequest next = move(_pending.front());
+    _pending.pop_front();
+
+    ExchangeContext context;
+    context.outbox = &_session->outbox;
+    context.frames = &_session->frames;
+    context.on_message = move(next.on_message);
+    context.on_user = move(next.on_user);
+    ResponseHandler done = move(next.done);
+    async_exchange(_session->socket, _manager.endpoints(), move(next.packet),
+        [this, done](const boost::system::error_code& ec, Response resp) {
+            done(ec, move(resp));
+            run_next();
+        }, move(context));
+}
+
+// 2103: recipient id (16) | message id (4)
+void MessageClient::send(vector<uint8_t> packet, SentHandler done) {
+    request(move(packet), [done](const boost::system::error_code& ec, Response resp) {
+        boost::system::error_code result = check_response(ec, resp, 2103);
+        if (!result && resp.payload.size() < ClientId::SIZE + 4) {
+            result = ClientError::bad_response;
+        }
+        if (result) {
+            done(result, 0);
+            return;
+        }
+        const uint8_t* p = resp.payload.data() + ClientId::SIZE;
+        uint32_t message_id = static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16
+            | static_cast<uint32_t>(p[2]) << 8 | p[3];
+        done(boost::system::error_code(), message_id);
+    });
+}
+
+//===========================
+// operations
+//===========================
+
+void MessageClient::register_user(const string& username, IdHandler done) {
+    // generate key pair with the default suite, the public key carries its suite tag
+    // (held in a shared_ptr so the handler stays copyable, moved into the session on success)
+    shared_ptr<unique_ptr<KeyPair>> keys = make_shared<unique_ptr<KeyPair>>(make_unique<KeyPair>(DEFAULT_KEY_SUITE));
+    vector<uint8_t> packet = create_registration_packet(username, (*keys)->getPublicKey());
+
+    request(move(packet), [this, username, keys, done](const boost::system::error_code& ec, Response resp) {
+        boost::system::error_code result = check_response(ec, resp, 2100);
+        if (!result && resp.payload.size() < ClientId::SIZE) {
+            result = ClientError::bad_response;
+        }
+        if (result) {
+            done(result, ClientId());
+            return;
+        }
+        ClientId client_id(resp.payload.data());
+        _session->username = username;
+        _session->client_id = client_id;
+        _session->keys = move(*keys);
+        if (!save_user_to_file(username, client_id, _session->keys->getPrivateKey())) {
+            done(ClientError::user_not_saved, client_id);  // the session is logged in all the same
+            return;
+        }
+        done(boost::system::error_code(), client_id);
+    });
+}
+
+void MessageClient::list_users(UsersHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, vector<UserInfo>());
+        return;
+    }
+    // the directory is streamed a record at a time, so its size is not bound by the frame size limit
+    shared_ptr<vector<UserInfo>> users = make_shared<vector<UserInfo>>();
+    request(create_get_users_packet(_session->client_id), [users, done](const boost::system::error_code& ec, Response resp) {
+        boost::system::error_code result = check_response(ec, resp, 2101);
+        if (result) {
+            done(result, vector<UserInfo>());
+            return;
+        }
+        done(boost::system::error_code(), move(*users));
+    }, nullptr, [users](const uint8_t* record) {
+        // each user record is 16 bytes for user_id + 255 bytes for username = 271 bytes.
+        const char* name = reinterpret_cast<const char*>(record + ClientId::SIZE);
+        size_t length = 0;
+        while (length < 255 && name[length] != '\0') {
+            length++;
+        }
+        users->push_back(UserInfo{ ClientId(record), string(name, length) });
+    });
+}
+
+void MessageClient::get_public_key(const ClientId& user_id, KeyHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, string());
+        return;
+    }
+    request(create_get_public_key_packet(_session->client_id, user_id), [done](const boost::system::error_code& ec, Response resp) {
+        boost::system::error_code result = check_response(ec, resp, 2102);
+        if (!result && resp.payload.size() < ClientId::SIZE) {
+            result = ClientError::bad_response;
+        }
+        if (result) {
+            done(result, string());
+            return;
+        }
+        string public_key(resp.payload.begin() + ClientId::SIZE, resp.payload.end());
+        known_public_keys.insert(ClientId(resp.payload.data()), make_shared<string>(public_key));
+        done(boost::system::error_code(), move(public_key));
+    });
+}
+
+void MessageClient::request_symmetric_key(const ClientId& recipient_id, SentHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, 0);
+        return;
+    }
+    send(create_symmetric_key_request_packet(recipient_id, *_session), move(done));
+}
+
+void MessageClient::send_symmetric_key(const ClientId& recipient_id, SentHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, 0);
+        return;
+    }
+    if (!known_public_keys.find(recipient_id)) {
+        done(ClientError::no_public_key, 0);
+        return;
+    }
+    vector<uint8_t> packet;
+    try {
+        packet = create_symmetric_key_packet(recipient_id, *_session);
+    }
+    catch (const exception&) {
+        done(ClientError::no_public_key, 0);  // the stored key could not be used
+        return;
+    }
+    send(move(packet), move(done));
+}
+
+void MessageClient::send_message(const ClientId& recipient_id, const string& text, SentHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, 0);
+        return;
+    }
+    // text goes out encrypted with the cached session key only
+    if (!has_symmetric_key_for_user(_session->client_id, recipient_id)) {
+        done(ClientError::no_session_key, 0);
+        return;
+    }
+    string content = encrypt_message_for_user(_session->client_id, recipient_id, text);
+    send(create_message_packet(_session->client_id, recipient_id, content, MSG_AEAD_TEXT), move(done));
+}
+
+void MessageClient::send_envelope(const vector<ClientId>& recipient_ids, const string& text, SentHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, 0);
+        return;
+    }
+    if (recipient_ids.empty()) {
+        done(boost::asio::error::invalid_argument, 0);
+        return;
+    }
+    // one upload: the server hands each recipient its own wrapped key and the shared body.
+    // the key wraps run on the thread pool, the send comes back to the strand
+    ClientId sender_id = _session->client_id;
+    try {
+        create_envelope(recipient_ids, text, [this, sender_id, done](exception_ptr error, string envelope) {
+            boost::asio::post(_session->strand, [this, sender_id, done, error, envelope = move(envelope)]() {
+                if (error) {
+                    done(ClientError::no_public_key, 0);  // a stored key could not be used
+                    return;
+                }
+                send(create_message_packet(sender_id, ClientId(), envelope, MSG_ENVELOPE), done);
+            });
+        });
+    }
+    catch (const invalid_argument&) {
+        done(boost::asio::error::invalid_argument, 0);  // too many recipients
+    }
+    catch (const exception&) {
+        done(ClientError::no_public_key, 0);
+    }
+}
+
+void MessageClient::pull_messages(MessagesHandler done) {
+    shared_ptr<vector<PulledMessage>> all = make_shared<vector<PulledMessage>>();
+    pull_messages([all](vector<PulledMessage> batch) {
+        all->insert(all->end(), make_move_iterator(batch.begin()), make_move_iterator(batch.end()));
+    }, [all, done](const boost::system::error_code& ec, size_t) {
+        done(ec, move(*all));
+    });
+}
+
+void MessageClient::pull_messages(MessageBatchHandler on_batch, CountHandler done) {
+    if (_session->client_id.empty()) {
+        done(ClientError::not_registered, 0);
+        return;
+    }
+    // touched on the strand only
+    struct PullState {
+        vector<PulledMessage> window;
+        deque<vector<PulledMessage>> waiting;   // full windows, decrypted one after the other
+        bool decrypting = false;
+        bool finished = false;                  // the response is complete, result is set
+        boost::system::error_code result;
+        size_t count = 0;
+    };
+    shared_ptr<PullState> state = make_shared<PullState>();
+    ClientId owner_id = _session->client_id;
+    shared_ptr<KeyPair> own_keys = _session->keys;
+
+    // decryption runs on the thread pool and comes back to the strand, the io thread never waits
+    // for it. a batch may use the keys of the one before, so one batch is decrypted at a time;
+    // every batch comes back in message ID order
+    shared_ptr<function<void()>> decrypt_next = make_shared<function<void()>>();
+    weak_ptr<function<void()>> next_ref = decrypt_next;
+    *decrypt_next = [this, state, on_batch, done, owner_id, own_keys, next_ref]() {
+        if (state->waiting.empty()) {
+            state->decrypting = false;
+            if (state->finished) {
+                done(state->result, state->count);
+            }
+            return;
+        }
+        state->decrypting = true;
+        vector<PulledMessage> batch = move(state->waiting.front());
+        state->waiting.pop_front();
+        shared_ptr<function<void()>> next = next_ref.lock();
+        decrypt_pulled_messages(move(batch), owner_id, own_keys, [this, on_batch, next](vector<PulledMessage> decrypted) {
+            boost::asio::post(_session->strand, [on_batch, next, decrypted = move(decrypted)]() mutable {
+                on_batch(move(decrypted));
+                (*next)();
+            });
+        });
+    };
+    auto flush = [state, decrypt_next]() {
+        if (!state->window.empty()) {
+            state->waiting.push_back(move(state->window));
+            state->window.clear();
+        }
+        if (!state->decrypting) {
+            (*decrypt_next)();
+        }
+    };
+
+    request(create_pull_messages_packet(_session->client_id), [state, flush](const boost::system::error_code& ec, Response resp) {
+        state->result = check_response(ec, resp, 2104);
+        state->finished = true;
+        if (state->result) {
+            state->window.clear();  // the batches already handed to decryption are still delivered
+        }
+        flush();  // completes once the last batch is delivered
+    }, [state, flush](PulledMessage&& msg) {
+        // records are handed out while the 2104 payload is still arriving
+        state->window.push_back(move(msg));
+        state->count++;
+        if (state->window.size() == PULL_BATCH_SIZE) {
+            flush();
+        }
+    });
+}
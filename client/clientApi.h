@@ -0,0 +1,237 @@
+#pragma once
+#ifndef CLIENT_API_H
+#define CLIENT_API_H
+
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "clientId.h"
+#include "clientSession.h"
+#include "network.h"
+#include "sessionManager.h"
+
+// client library: the protocol as typed async operations on one session, no console involved.
+// every operation takes an asio completion token, so the same call works with a callback
+//     client.async_list_users([](boost::system::error_code ec, std::vector<UserInfo> users) { ... });
+// and in a C++20 coroutine
+//     std::vector<UserInfo> users = co_await client.async_list_users(boost::asio::use_awaitable);
+// (or boost::asio::use_future, ...). operations start on the session strand, which is the only
+// place the session's fields are touched; requests of one session go to the server one at a time
+// in the order they were started. results are delivered on the handler's associated executor,
+// the session strand for plain callbacks.
+
+enum class ClientError {
+    server_error = 1,   // the server answered 9000
+    not_registered,     // no client id yet: register or log in first
+    no_public_key,      // recipient's public key was not requested yet
+    no_session_key,     // no symmetric key shared with the recipient yet
+    bad_response,       // response code or payload that does not fit the request
+    no_saved_user,      // login: user not in my.info, or its private key can't be read
+    user_not_saved      // registered (the id is passed along), but my.info could not be written
+};
+
+const boost::system::error_category& client_category();
+boost::system::error_code make_error_code(ClientError e);
+
+namespace boost {
+    namespace system {
+        template <>
+        struct is_error_code_enum<ClientError> : std::true_type {};
+    }
+}
+
+// one record of the 2101 users list
+struct UserInfo {
+    ClientId id;
+    std::string username;
+};
+
+namespace client_detail {
+    // initiation shared by all operations: the handler is kept in a shared_ptr (std::function
+    // needs a copyable callable) and invoked on its associated executor, which is kept busy meanwhile
+    template <class... Args>
+    struct Initiate {
+        template <class Handler, class Start>
+        void operator()(Handler&& handler, Start start, boost::asio::any_io_executor fallback) const {
+            typedef typename std::decay<Handler>::type handler_type;
+            auto work = boost::asio::make_work_guard(boost::asio::get_associated_executor(handler, fallback));
+            auto shared = std::make_shared<handler_type>(std::forward<Handler>(handler));
+            start(std::function<void(Args...)>([shared, work](Args... args) mutable {
+                auto call = [shared, result = std::make_tuple(std::move(args)...)]() mutable {
+                    std::apply(std::move(*shared), std::move(result));
+                };
+                boost::asio::dispatch(work.get_executor(), std::move(call));
+                work.reset();
+            }));
+        }
+    };
+}
+
+// the session (and the manager it came from) must outlive the client and its pending operations
+class MessageClient {
+public:
+    typedef std::function<void(std::vector<PulledMessage>)> MessageBatchHandler;
+
+    // pulled messages are decrypted and handed out in batches of this size while the 2104 payload arrives
+    static const size_t PULL_BATCH_SIZE = 64;
+
+    MessageClient(SessionManager& manager, std::shared_ptr<ClientSession> session);
+
+    MessageClient(const MessageClient&) = delete;
+    MessageClient& operator=(const MessageClient&) = delete;
+
+    ClientSession& session() { return *_session; }
+    boost::asio::any_io_executor get_executor() const { return _session->strand; }
+
+    // user registered before (my.info): restores id, key pair and cached session keys, no request sent.
+    // the files are read by the caller, the session takes them over on the strand, so operations
+    // started after it see the login. completion gets the number of cached session keys
+    template <class Token>
+    auto async_login(const std::string& username, Token&& token);   // void(error_code, size_t)
+
+    // 600 -> 2100. new key pair, the record is saved to my.info
+    template <class Token>
+    auto async_register_user(const std::string& username, Token&& token);   // void(error_code, ClientId)
+
+    // 601 -> 2101
+    template <class Token>
+    auto async_list_users(Token&& token);   // void(error_code, std::vector<UserInfo>)
+
+    // 602 -> 2102, the key is also kept for sending symmetric keys / envelopes
+    template <class Token>
+    auto async_get_public_key(const ClientId& user_id, Token&& token);   // void(error_code, std::string)
+
+    // 603 -> 2103, message type 1 / 2 / 5 / 6. completion gets the message id
+    template <class Token>
+    auto async_request_symmetric_key(const ClientId& recipient_id, Token&& token);   // void(error_code, uint32_t)
+    template <class Token>
+    auto async_send_symmetric_key(const ClientId& recipient_id, Token&& token);      // void(error_code, uint32_t)
+    template <class Token>
+    auto async_send_message(const ClientId& recipient_id, const std::string& text, Token&& token);   // void(error_code, uint32_t)
+    template <class Token>
+    auto async_send_message(const std::vector<ClientId>& recipient_ids, const std::string& text, Token&& token);   // void(error_code, uint32_t)
+
+    // 604 -> 2104, decrypted. the whole inbox at once
+    template <class Token>
+    auto async_pull_messages(Token&& token);   // void(error_code, std::vector<PulledMessage>)
+
+    // 604 -> 2104, decrypted batches go to on_batch (on the session strand) while the payload
+    // is still arriving, completion gets the number of messages
+    template <class Token>
+    auto async_pull_messages(MessageBatchHandler on_batch, Token&& token);   // void(error_code, size_t)
+
+private:
+    typedef std::function<void(boost::system::error_code, ClientId)> IdHandler;
+    typedef std::function<void(boost::system::error_code, std::vector<UserInfo>)> UsersHandler;
+    typedef std::function<void(boost::system::error_code, std::string)> KeyHandler;
+    typedef std::function<void(boost::system::error_code, uint32_t)> SentHandler;
+    typedef std::function<void(boost::system::error_code, size_t)> CountHandler;
+    typedef std::function<void(boost::system::error_code, std::vector<PulledMessage>)> MessagesHandler;
+
+    struct PendingRequest {
+        std::vector<uint8_t> packet;
+        ResponseHandler done;
+        PulledMessageHandler on_message;
+        UserRecordHandler on_user;
+    };
+
+    SessionManager& _manager;
+    std::shared_ptr<ClientSession> _session;
+    std::deque<PendingRequest> _pending;   // touched on the strand only
+    bool _busy;
+
+    void start(std::function<void()> operation);
+    void request(std::vector<uint8_t> packet, ResponseHandler done, PulledMessageHandler on_message = nullptr,
+        UserRecordHandler on_user = nullptr);
+    void run_next();
+    void send(std::vector<uint8_t> packet, SentHandler done);
+
+    void login(const std::string& username, CountHandler done);
+    void register_user(const std::string& username, IdHandler done);
+    void list_users(UsersHandler done);
+    void get_public_key(const ClientId& user_id, KeyHandler done);
+    void request_symmetric_key(const ClientId& recipient_id, SentHandler done);
+    void send_symmetric_key(const ClientId& recipient_id, SentHandler done);
+    void send_message(const ClientId& recipient_id, const std::string& text, SentHandler done);
+    void send_envelope(const std::vector<ClientId>& recipient_ids, const std::string& text, SentHandler done);
+    void pull_messages(MessagesHandler done);
+    void pull_messages(MessageBatchHandler on_batch, CountHandler done);
+};
+
+template <class Token>
+auto MessageClient::async_login(const std::string& username, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, size_t)>(
+        client_detail::Initiate<boost::system::error_code, size_t>(), token,
+        [this, username](CountHandler done) { login(username, std::move(done)); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_register_user(const std::string& username, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, ClientId)>(
+        client_detail::Initiate<boost::system::error_code, ClientId>(), token,
+        [this, username](IdHandler done) { start([this, username, done]() { register_user(username, done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_list_users(Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, std::vector<UserInfo>)>(
+        client_detail::Initiate<boost::system::error_code, std::vector<UserInfo>>(), token,
+        [this](UsersHandler done) { start([this, done]() { list_users(done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_get_public_key(const ClientId& user_id, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, std::string)>(
+        client_detail::Initiate<boost::system::error_code, std::string>(), token,
+        [this, user_id](KeyHandler done) { start([this, user_id, done]() { get_public_key(user_id, done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_request_symmetric_key(const ClientId& recipient_id, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, uint32_t)>(
+        client_detail::Initiate<boost::system::error_code, uint32_t>(), token,
+        [this, recipient_id](SentHandler done) { start([this, recipient_id, done]() { request_symmetric_key(recipient_id, done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_send_symmetric_key(const ClientId& recipient_id, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, uint32_t)>(
+        client_detail::Initiate<boost::system::error_code, uint32_t>(), token,
+        [this, recipient_id](SentHandler done) { start([this, recipient_id, done]() { send_symmetric_key(recipient_id, done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_send_message(const ClientId& recipient_id, const std::string& text, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, uint32_t)>(
+        client_detail::Initiate<boost::system::error_code, uint32_t>(), token,
+        [this, recipient_id, text](SentHandler done) { start([this, recipient_id, text, done]() { send_message(recipient_id, text, done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_send_message(const std::vector<ClientId>& recipient_ids, const std::string& text, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, uint32_t)>(
+        client_detail::Initiate<boost::system::error_code, uint32_t>(), token,
+        [this, recipient_ids, text](SentHandler done) { start([this, recipient_ids, text, done]() { send_envelope(recipient_ids, text, done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_pull_messages(Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, std::vector<PulledMessage>)>(
+        client_detail::Initiate<boost::system::error_code, std::vector<PulledMessage>>(), token,
+        [this](MessagesHandler done) { start([this, done]() { pull_messages(done); }); }, get_executor());
+}
+
+template <class Token>
+auto MessageClient::async_pull_messages(MessageBatchHandler on_batch, Token&& token) {
+    return boost::asio::async_initiate<Token, void(boost::system::error_code, size_t)>(
+        client_detail::Initiate<boost::system::error_code, size_t>(), token,
+        [this, on_batch](CountHandler done) { start([this, on_batch, done]() { pull_messages(on_batch, done); }); }, get_executor());
+}
+
+#endif // CLIENT_API_H
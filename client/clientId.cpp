@@ -0,0 +1,45 @@
+// text form of client ids for the local files
+
+#include "clientId.h"
+#include <stdexcept>
+
+using namespace std;
+
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+ClientId ClientId::from_hex(const string& text) {
+    uint8_t bytes[SIZE] = { 0 };
+    if (text.size() == SIZE) {
+        memcpy(bytes, text.data(), SIZE);  // legacy: the id itself was written
+        return ClientId(bytes);
+    }
+    if (text.size() != 2 * SIZE) {
+        throw invalid_argument("client id must be 32 hex digits");
+    }
+    for (size_t i = 0; i < SIZE; i++) {
+        int high = hex_value(text[2 * i]);
+        int low = hex_value(text[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            throw invalid_argument("client id must be 32 hex digits");
+        }
+        bytes[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return ClientId(bytes);
+}
+
+string ClientId::to_hex() const {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(2 * SIZE);
+    for (uint8_t b : _bytes) {
+        hex.push_back(digits[b >> 4]);
+        hex.push_back(digits[b & 0x0F]);
+    }
+    return hex;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef CLIENT_ID_H
+#define CLIENT_ID_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+// 16 byte client id, kept in its wire form from the server's 2100 response to every
+// packet header, payload and lookup. an all zero id means "not registered".
+class ClientId {
+public:
+    static const size_t SIZE = 16;
+
+    ClientId() : _bytes() {}
+    explicit ClientId(const uint8_t* bytes) { memcpy(_bytes.data(), bytes, SIZE); }
+
+    // my.info / keys.info form: 32 hex digits. ids saved by older clients (16 raw characters) are read as is
+    static ClientId from_hex(const std::string& text);
+    std::string to_hex() const;
+
+    const uint8_t* data() const { return _bytes.data(); }
+    bool empty() const { return *this == ClientId(); }
+
+    bool operator==(const ClientId& other) const { return _bytes == other._bytes; }
+    bool operator!=(const ClientId& other) const { return _bytes != other._bytes; }
+    bool operator<(const ClientId& other) const { return _bytes < other._bytes; }
+
+private:
+    std::array<uint8_t, SIZE> _bytes;
+};
+
+// ids are random (uuid), so folding the two halves and mixing them once is enough (splitmix64 finalizer)
+struct ClientIdHash {
+    size_t operator()(const ClientId& id) const {
+        uint64_t a, b;
+        memcpy(&a, id.data(), 8);
+        memcpy(&b, id.data() + 8, 8);
+        uint64_t h = a ^ (b * 0x9E3779B97F4A7C15ULL);
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return static_cast<size_t>(h ^ (h >> 31));
+    }
+};
+
+namespace std {
+    template <>
+    struct hash<ClientId> : ClientIdHash {};
+}
+
+#endif // CLIENT_ID_H
@@ -0,0 +1,31 @@
+#pragma once
+#ifndef CLIENT_SESSION_H
+#define CLIENT_SESSION_H
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <string>
+#include "clientId.h"
+#include "keyExchange.h"
+#include "sendQueue.h"
+#include "frameDecoder.h"
+
+using boost::asio::ip::tcp;
+
+// state of one logged in user: identity, keys and the connection to the server
+class ClientSession {
+public:
+    std::string username; // holds the username entered by the user.
+    ClientId client_id; // holds id the assigned from registration
+    boost::asio::strand<boost::asio::io_context::executor_type> strand; // serializes this session's async work
+    tcp::socket socket; // bound to the strand, so its completion handlers never run concurrently
+    SendQueue outbox; // every packet of this session goes out through here, from any thread
+    FrameDecoder frames; // receive buffer of the current connection
+    std::shared_ptr<KeyPair> keys; // own key pair (RSA or X25519, see keyExchange.h), shared with decryption running on the pool
+
+    // constructor: initializes the strand, socket and send queue with the io_context.
+    ClientSession(boost::asio::io_context& io_context)
+        : strand(boost::asio::make_strand(io_context)), socket(strand), outbox(socket) {}
+};
+
+#endif // CLIENT_SESSION_H
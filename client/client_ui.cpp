@@ -1,46 +1,157 @@
 #include "client_ui.h"
 #include <iostream>
 #include <string>
-#include "network.h"  
+#include <atomic>
+#include <thread>
+#include "network.h"
 
 
 using namespace std;
 
+// console output goes through the render thread once it is started, before that it is printed directly
+static RenderQueue render_queue;
+static Wakeup render_pushed;   // wakes the render thread, also on stop
+static Wakeup render_popped;   // wakes writers waiting on a full queue
+static atomic<bool> renderer_running(false);
+static thread renderer;
+
+static void print_item(const RenderItem& item) {
+    if (item.kind == RenderItem::ERROR_LINE) {
+        cerr << "Error: " << item.text << endl;
+    }
+    else if (item.kind == RenderItem::PROMPT) {
+        cout << item.text << flush;
+    }
+    else {
+        cout << item.text << endl;
+    }
+}
+
+static void emit(RenderItem::Kind kind, const string& text) {
+    if (!renderer_running) {
+        print_item(RenderItem{ kind, text });
+        return;
+    }
+    RenderItem* item = new RenderItem{ kind, text };
+    wait_until(render_popped, [item]() { return render_queue.push(item); });  // full: wait for the render thread
+    render_pushed.notify();
+}
+
+static void render_loop() {
+    RenderItem* item;
+    while (true) {
+        bool stopped = false;
+        wait_until(render_pushed, [&item, &stopped]() {
+            if (render_queue.pop(item)) {
+                return true;
+            }
+            stopped = !renderer_running;
+            return stopped;
+        });
+        if (stopped) {
+            break;  // stopped and drained
+        }
+        render_popped.notify();
+        print_item(*item);
+        delete item;
+    }
+}
+
+void start_renderer() {
+    if (!renderer_running.exchange(true)) {
+        renderer = thread(render_loop);
+    }
+}
+
+void stop_renderer() {
+    if (renderer_running.exchange(false)) {
+        render_pushed.notify();
+        renderer.join();
+    }
+}
+
 // function to get user input (message to send)
 // input cant be string or number that does not exist
 int get_user_input() {
     string input;
-    cout << "\nChoose an option:" << endl;
-    cout << "110 - Register User" << endl;
-    cout << "120 - Request for clients list" << endl;
-    cout << "130 - Request for public key" << endl;
-    cout << "140 - Request for waiting messages" << endl;
-    cout << "150 - Send a text message" << endl;
-    cout << "0 - Exit client" << endl;
-    cout << "Enter your choice: ";
-    getline(cin, input); 
+    display_prompt("\nChoose an option:\n"
+        "110 - Register User\n"
+        "120 - Request for clients list\n"
+        "130 - Request for public key\n"
+        "140 - Request for waiting messages\n"
+        "150 - Send a text message\n"
+        "151 - Send a request for symmetric key\n"
+        "152 - Send your symmetric key\n"
+        "160 - Send a text message to several users\n"
+        "0 - Exit client\n"
+        "Enter your choice: ");
+    if (!getline(cin, input)) {
+        return 0;  // stdin closed, exit
+    }
 
     try {
-        int option = stoi(input);  
+        int option = stoi(input);
         return option;
     }
     catch (const exception&) {
-        return -1;  
+        return -1;
     };
 }
 
+static string read_line(const string& prompt) {
+    string line;
+    display_prompt(prompt);
+    getline(cin, line);
+    return line;
+}
+
+// reads the option and every field it needs
+UserCommand read_user_command() {
+    UserCommand command;
+    command.option = get_user_input();
+    switch (command.option) {
+    case 110:
+        command.target = read_line("Enter username for registration: ");
+        break;
+    case 130:
+        command.target = read_line("Enter recipient username: ");
+        break;
+    case 150:
+        command.target = read_line("Enter recipient's username: \n");
+        command.text = read_line("Enter your message: \n");
+        break;
+    case 151:
+    case 152:
+        command.target = read_line("Enter recipient's username: \n");
+        break;
+    case 160:
+        command.target = read_line("Enter recipients' usernames (comma separated): \n");
+        command.text = read_line("Enter your message: \n");
+        break;
+    default:
+        break;
+    }
+    return command;
+}
+
+void display_prompt(const string& prompt) {
+    emit(RenderItem::PROMPT, prompt);
+}
+
 void display_message(const string& message) {
-    cout << " " << message << endl;
+    emit(RenderItem::LINE, " " + message);
 }
 
 // display error messages
 void display_err(const string& error_message) {
-    cerr << "Error: " << error_message << endl;
+    emit(RenderItem::ERROR_LINE, error_message);
 }
 
 void display_user_list(const vector<string>& user_list) {
-    cout << "User List:" << endl;
+    // one item, so other output can't land in the middle of the list
+    string text = "User List:";
     for (const auto& user : user_list) {
-        cout << " - " << user << endl;
+        text += "\n - " + user;
     }
+    emit(RenderItem::LINE, text);
 }
@@ -6,12 +6,23 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include "threadQueues.h"
 
 using namespace std;
 
 //get users input
 int get_user_input();
 
+//get users input with all fields of the chosen option (runs on the input thread)
+UserCommand read_user_command();
+
+//console output runs on its own thread between these calls
+void start_renderer();
+void stop_renderer();
+
+//display a prompt (no new line)
+void display_prompt(const string& prompt);
+
 //display messages receved from server
 void display_message(const string& message);
 
@@ -11,7 +11,7 @@ opens file with connection info
 using namespace std;
 
 //constructor with default values
-config::config() : serverIP("127.0.0.1"), serverPort(1234) {}  
+config::config() : serverIP("127.0.0.1"), serverPort(1234), maxFrameSize(0) {}  
 
 void config::load_file(const string& filename) {
     ifstream configFile(filename);
@@ -28,6 +28,16 @@ void config::load_file(const string& filename) {
         else {
             cerr << "Error! using default values." << std::endl;
         }
+
+        // optional second line: max_frame_size:<bytes>, biggest response read whole (or pulled message) accepted
+        if (getline(configFile, line) && line.rfind("max_frame_size:", 0) == 0) {
+            try {
+                maxFrameSize = stoull(line.substr(line.find(":") + 1));
+            }
+            catch (const exception&) {
+                cerr << "Error! bad max_frame_size, using default." << std::endl;
+            }
+        }
         configFile.close();
     }
     else {
@@ -45,5 +55,10 @@ int config::get_port() const {
     return serverPort;
 }
 
+// getter for the response size limit
+size_t config::get_max_frame_size() const {
+    return maxFrameSize;
+}
+
 
 
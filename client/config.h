@@ -13,10 +13,12 @@ public:
 
     std::string get_ip() const;  
     int get_port() const;  
+    size_t get_max_frame_size() const;  // 0 = not set, use the default
 
 private:
     std::string serverIP;  
     int serverPort;  
+    size_t maxFrameSize;
 };
 
 #endif
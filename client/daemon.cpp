@@ -0,0 +1,458 @@
+// headless daemon: local apps share one client session over a unix domain socket
+
+#include "daemon.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <unordered_set>
+#include "encryption.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using boost::asio::local::stream_protocol;
+
+
+static void put_u32(vector<uint8_t>& out, uint32_t value) {
+    for (int i = 3; i >= 0; --i) {
+        out.push_back((value >> (i * 8)) & 0xFF);
+    }
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16
+        | static_cast<uint32_t>(p[2]) << 8 | p[3];
+}
+
+static shared_ptr<const vector<uint8_t>> make_frame(uint32_t request_id, uint8_t status, const uint8_t* data, size_t size) {
+    shared_ptr<vector<uint8_t>> frame = make_shared<vector<uint8_t>>();
+    frame->reserve(Daemon::IPC_HEADER_SIZE + size);
+    put_u32(*frame, request_id);
+    frame->push_back(status);
+    put_u32(*frame, static_cast<uint32_t>(size));
+    frame->insert(frame->end(), data, data + size);
+    return frame;
+}
+
+static shared_ptr<const vector<uint8_t>> make_error_frame(uint32_t request_id, const string& error) {
+    return make_frame(request_id, IPC_ERROR, reinterpret_cast<const uint8_t*>(error.data()), error.size());
+}
+
+//===========================
+// one connected app
+//===========================
+
+class Daemon::Connection : public enable_shared_from_this<Connection> {
+public:
+    bool subscribed = false;
+
+    Connection(Daemon& daemon, stream_protocol::socket socket)
+        : _daemon(daemon), _socket(move(socket)), _pending_bytes(0), _writing(false), _closed(false) {}
+
+    void start() {
+        read_header();
+    }
+
+    // frames are queued and written together, an event is shared by every subscriber
+    void send(shared_ptr<const vector<uint8_t>> frame) {
+        if (_closed) {
+            return;
+        }
+        _pending_bytes += frame->size();
+        if (_pending_bytes > MAX_PENDING_OUTPUT) {
+            cerr << "daemon: dropping an app that stopped reading" << endl;
+            close();
+            return;
+        }
+        _out.push_back(move(frame));
+        if (!_writing) {
+            write_pending();
+        }
+    }
+
+    void close() {
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+        boost::system::error_code ignored;
+        _socket.close(ignored);
+        _daemon.closed(shared_from_this());
+    }
+
+private:
+    Daemon& _daemon;
+    stream_protocol::socket _socket;
+    uint8_t _header[IPC_HEADER_SIZE];
+    vector<uint8_t> _payload;
+    deque<shared_ptr<const vector<uint8_t>>> _out;
+    vector<shared_ptr<const vector<uint8_t>>> _inflight;
+    size_t _pending_bytes;
+    bool _writing;
+    bool _closed;
+
+    void read_header() {
+        auto self = shared_from_this();
+        boost::asio::async_read(_socket, boost::asio::buffer(_header), [this, self](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                close();
+                return;
+            }
+            uint32_t size = get_u32(_header + 5);
+            if (size > MAX_REQUEST_SIZE) {
+                send(make_error_frame(get_u32(_header), "request too large"));
+                close();
+                return;
+            }
+            _payload.resize(size);
+            read_payload();
+        });
+    }
+
+    void read_payload() {
+        auto self = shared_from_this();
+        boost::asio::async_read(_socket, boost::asio::buffer(_payload), [this, self](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                close();
+                return;
+            }
+            _daemon.handle(self, get_u32(_header), _header[4], move(_payload));
+            _payload.clear();
+            if (!_closed) {
+                read_header();
+            }
+        });
+    }
+
+    void write_pending() {
+        _writing = true;
+        _inflight.assign(make_move_iterator(_out.begin()), make_move_iterator(_out.end()));
+        _out.clear();
+        vector<boost::asio::const_buffer> buffers;
+        buffers.reserve(_inflight.size());
+        for (const auto& frame : _inflight) {
+            buffers.push_back(boost::asio::buffer(*frame));
+        }
+        auto self = shared_from_this();
+        boost::asio::async_write(_socket, buffers, [this, self](const boost::system::error_code& ec, size_t written) {
+            _inflight.clear();
+            _writing = false;
+            if (ec) {
+                close();
+                return;
+            }
+            _pending_bytes -= written;
+            if (!_out.empty() && !_closed) {
+                write_pending();
+            }
+        });
+    }
+};
+
+//===========================
+// daemon
+//===========================
+
+Daemon::Daemon(MessageClient& client, const string& socket_path, chrono::milliseconds poll_interval)
+    : _client(client), _socket_path(socket_path), _poll_interval(poll_interval),
+    _acceptor(client.get_executor()), _poll(client.get_executor()), _signals(client.get_executor()),
+    _batch_running(false), _stopped(false) {}
+
+void Daemon::start() {
+    remove(_socket_path.c_str());  // left over from a daemon that did not shut down
+    stream_protocol::endpoint endpoint(_socket_path);
+    _acceptor.open(endpoint.protocol());
+#ifndef _WIN32
+    // apps of this user only: the socket is created without group / other bits, so nobody else
+    // can connect between bind and chmod
+    mode_t old_mask = umask(S_IRWXG | S_IRWXO);
+    try {
+        _acceptor.bind(endpoint);
+    }
+    catch (...) {
+        umask(old_mask);
+        throw;
+    }
+    umask(old_mask);
+    if (chmod(_socket_path.c_str(), S_IRUSR | S_IWUSR) != 0) {
+        boost::system::error_code ec(errno, boost::system::system_category());
+        _acceptor.close();
+        remove(_socket_path.c_str());
+        throw boost::system::system_error(ec, "chmod " + _socket_path);
+    }
+#else
+    _acceptor.bind(endpoint);
+#endif
+    _acceptor.listen();
+
+    _signals.add(SIGINT);
+    _signals.add(SIGTERM);
+    _signals.async_wait([this](const boost::system::error_code& ec, int) {
+        if (!ec) {
+            shutdown();
+        }
+    });
+
+    boost::asio::post(_client.get_executor(), [this]() {
+        accept();
+        schedule_poll();
+    });
+}
+
+void Daemon::stop() {
+    boost::asio::post(_client.get_executor(), [this]() { shutdown(); });
+}
+
+void Daemon::wait() {
+    unique_lock<mutex> lock(_stop_lock);
+    _stopped_cv.wait(lock, [this]() { return _stopped; });
+}
+
+void Daemon::shutdown() {
+    {
+        lock_guard<mutex> lock(_stop_lock);
+        if (_stopped) {
+            return;
+        }
+        _stopped = true;
+    }
+    boost::system::error_code ignored;
+    _acceptor.close(ignored);
+    _poll.cancel();
+    _signals.cancel(ignored);
+    set<shared_ptr<Connection>> connections;
+    connections.swap(_connections);
+    for (const auto& connection : connections) {
+        connection->close();
+    }
+    remove(_socket_path.c_str());
+    _stopped_cv.notify_all();
+}
+
+void Daemon::accept() {
+    _acceptor.async_accept(_client.get_executor(), [this](const boost::system::error_code& ec, stream_protocol::socket socket) {
+        if (ec == boost::asio::error::operation_aborted || !_acceptor.is_open()) {
+            return;
+        }
+        if (!ec) {
+            auto connection = make_shared<Connection>(*this, move(socket));
+            _connections.insert(connection);
+            connection->start();
+        }
+        accept();
+    });
+}
+
+void Daemon::closed(const shared_ptr<Connection>& connection) {
+    _connections.erase(connection);
+}
+
+void Daemon::handle(const shared_ptr<Connection>& from, uint32_t request_id, uint8_t op, vector<uint8_t> payload) {
+    if (op == IPC_SEND) {
+        if (payload.size() < ClientId::SIZE) {
+            from->send(make_error_frame(request_id, "send: payload too small"));
+            return;
+        }
+        Send send{ from, request_id, { ClientId(payload.data()) }, false,
+            string(payload.begin() + ClientId::SIZE, payload.end()) };
+        submit(move(send));
+    }
+    else if (op == IPC_SEND_MANY) {
+        size_t count = payload.size() >= 2 ? (payload[0] << 8 | payload[1]) : 0;
+        if (count == 0 || payload.size() < 2 + count * ClientId::SIZE) {
+            from->send(make_error_frame(request_id, "send many: bad recipient list"));
+            return;
+        }
+        Send send{ from, request_id, {}, true, string(payload.begin() + 2 + count * ClientId::SIZE, payload.end()) };
+        for (size_t i = 0; i < count; i++) {
+            send.recipients.push_back(ClientId(payload.data() + 2 + i * ClientId::SIZE));
+        }
+        submit(move(send));
+    }
+    else if (op == IPC_SUBSCRIBE || op == IPC_UNSUBSCRIBE) {
+        from->subscribed = (op == IPC_SUBSCRIBE);
+        from->send(make_frame(request_id, IPC_OK, nullptr, 0));
+    }
+    else {
+        from->send(make_error_frame(request_id, "unknown op " + to_string(op)));
+    }
+}
+
+//===========================
+// outgoing batches
+//===========================
+
+void Daemon::submit(Send send) {
+    _batch.push_back(move(send));
+    if (!_batch_running) {
+        // started from the strand queue, so requests already read from other apps join in
+        _batch_running = true;
+        boost::asio::post(_client.get_executor(), [this]() { run_batch(); });
+    }
+}
+
+void Daemon::run_batch() {
+    if (_batch.empty() || _stopped) {
+        _batch_running = false;
+        return;
+    }
+    shared_ptr<vector<Send>> batch = make_shared<vector<Send>>(move(_batch));
+    _batch.clear();
+
+    // what the batch needs before its messages can go out, each at most once
+    unordered_set<ClientId, ClientIdHash> public_keys, session_keys;
+    for (const Send& send : *batch) {
+        for (const ClientId& recipient : send.recipients) {
+            bool needs_session_key = !send.envelope && !has_symmetric_key_for_user(_client.session().client_id, recipient);
+            if (needs_session_key) {
+                session_keys.insert(recipient);
+            }
+            if ((send.envelope || needs_session_key) && !known_public_keys.find(recipient)) {
+                public_keys.insert(recipient);
+            }
+        }
+    }
+
+    shared_ptr<Failures> failed = make_shared<Failures>();
+    vector<ClientId> session_key_ids(session_keys.begin(), session_keys.end());
+    fetch_public_keys(vector<ClientId>(public_keys.begin(), public_keys.end()), failed,
+        [this, batch, failed, session_key_ids]() {
+            send_session_keys(session_key_ids, failed, [this, batch, failed]() { send_batch(batch, failed); });
+        });
+}
+
+void Daemon::fetch_public_keys(vector<ClientId> ids, shared_ptr<Failures> failed, function<void()> next) {
+    if (ids.empty()) {
+        next();
+        return;
+    }
+    shared_ptr<size_t> left = make_shared<size_t>(ids.size());
+    for (const ClientId& id : ids) {
+        _client.async_get_public_key(id, [id, failed, left, next](const boost::system::error_code& ec, string) {
+            if (ec) {
+                (*failed)[id] = ec;
+            }
+            if (--*left == 0) {
+                next();
+            }
+        });
+    }
+}
+
+void Daemon::send_session_keys(vector<ClientId> ids, shared_ptr<Failures> failed, function<void()> next) {
+    vector<ClientId> usable;
+    for (const ClientId& id : ids) {
+        if (failed->find(id) == failed->end()) {
+            usable.push_back(id);
+        }
+    }
+    if (usable.empty()) {
+        next();
+        return;
+    }
+    shared_ptr<size_t> left = make_shared<size_t>(usable.size());
+    for (const ClientId& id : usable) {
+        _client.async_send_symmetric_key(id, [id, failed, left, next](const boost::system::error_code& ec, uint32_t) {
+            if (ec) {
+                (*failed)[id] = ec;
+            }
+            if (--*left == 0) {
+                next();
+            }
+        });
+    }
+}
+
+void Daemon::send_batch(shared_ptr<vector<Send>> batch, shared_ptr<Failures> failed) {
+    shared_ptr<size_t> left = make_shared<size_t>(batch->size());
+    auto finished = [this, left]() {
+        if (--*left == 0) {
+            run_batch();  // whatever arrived meanwhile
+        }
+    };
+    for (Send& send : *batch) {
+        auto reply = [from = send.from, request_id = send.request_id, finished](const boost::system::error_code& ec, uint32_t message_id) {
+            if (ec) {
+                from->send(make_error_frame(request_id, ec.message()));
+            }
+            else {
+                uint8_t id[4] = { uint8_t(message_id >> 24), uint8_t(message_id >> 16), uint8_t(message_id >> 8), uint8_t(message_id) };
+                from->send(make_frame(request_id, IPC_OK, id, sizeof(id)));
+            }
+            finished();
+        };
+        boost::system::error_code error;
+        for (const ClientId& recipient : send.recipients) {
+            auto it = failed->find(recipient);
+            if (it != failed->end()) {
+                error = it->second;
+            }
+        }
+        if (error) {
+            reply(error, 0);
+        }
+        else if (send.envelope) {
+            _client.async_send_message(send.recipients, send.text, reply);
+        }
+        else {
+            _client.async_send_message(send.recipients[0], send.text, reply);
+        }
+    }
+}
+
+//===========================
+// inbound messages
+//===========================
+
+void Daemon::schedule_poll() {
+    _poll.expires_after(_poll_interval);
+    _poll.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec && !_stopped) {
+            poll();
+        }
+    });
+}
+
+void Daemon::poll() {
+    bool subscribers = false;
+    for (const auto& connection : _connections) {
+        subscribers = subscribers || connection->subscribed;
+    }
+    if (!subscribers) {
+        schedule_poll();  // nobody would get them, they stay on the server
+        return;
+    }
+    _client.async_pull_messages([this](vector<PulledMessage> messages) {
+        publish(messages);
+    }, [this](const boost::system::error_code& ec, size_t) {
+        if (ec) {
+            cerr << "daemon: pulling messages failed: " << ec.message() << endl;
+        }
+        if (!_stopped) {
+            schedule_poll();
+        }
+    });
+}
+
+void Daemon::publish(const vector<PulledMessage>& messages) {
+    for (const PulledMessage& msg : messages) {
+        vector<uint8_t> event(msg.sender_id.data(), msg.sender_id.data() + ClientId::SIZE);
+        put_u32(event, msg.message_id);
+        event.push_back(msg.message_type);
+        event.insert(event.end(), msg.message_content.begin(), msg.message_content.end());
+        shared_ptr<const vector<uint8_t>> frame = make_frame(0, IPC_EVENT_MESSAGE, event.data(), event.size());
+
+        vector<shared_ptr<Connection>> subscribers;
+        for (const auto& connection : _connections) {
+            if (connection->subscribed) {
+                subscribers.push_back(connection);
+            }
+        }
+        for (const auto& connection : subscribers) {
+            connection->send(frame);  // may drop the connection
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "clientApi.h"
+
+// headless mode: one logged in session (client id, key pair, key caches) shared by local apps
+// over a unix domain socket, so they don't each register, load keys and exchange session keys.
+// all apps go through the one upstream session of the MessageClient; sends that arrive while a
+// batch is running are collected into the next batch, and every recipient in a batch that still
+// needs a public key or a session key gets it fetched / sent once for all of them.
+// inbound messages are pulled by one poll loop while anyone is subscribed and fanned out.
+//
+// ipc frames (big endian, like the server protocol):
+//   app -> daemon:  request id (4) | op (1)     | payload size (4) | payload
+//   daemon -> app:  request id (4) | status (1) | payload size (4) | payload
+// ops and their payloads:
+//   IPC_SEND         recipient id (16) | text                   ok: message id (4)
+//   IPC_SEND_MANY    count (2) | recipient ids (16 each) | text  ok: message id (4)
+//   IPC_SUBSCRIBE    -                                          ok, then IPC_EVENT_MESSAGE frames
+//   IPC_UNSUBSCRIBE  -                                          ok
+// IPC_ERROR replies carry the error text. events have request id 0 and the payload
+//   sender id (16) | message id (4) | message type (1) | text (decrypted)
+enum IpcOp : uint8_t {
+    IPC_SEND = 1,
+    IPC_SEND_MANY = 2,
+    IPC_SUBSCRIBE = 3,
+    IPC_UNSUBSCRIBE = 4
+};
+
+enum IpcStatus : uint8_t {
+    IPC_OK = 0,
+    IPC_ERROR = 1,
+    IPC_EVENT_MESSAGE = 0x80
+};
+
+// all daemon state lives on the session strand of the client
+class Daemon {
+public:
+    static const size_t IPC_HEADER_SIZE = 4 + 1 + 4;
+    static const size_t MAX_REQUEST_SIZE = 1024 * 1024;
+    // replies and events not yet read by an app; a subscriber that falls further behind is dropped
+    static const size_t MAX_PENDING_OUTPUT = 4 * 1024 * 1024;
+
+    Daemon(MessageClient& client, const std::string& socket_path,
+        std::chrono::milliseconds poll_interval = std::chrono::milliseconds(1000));
+
+    Daemon(const Daemon&) = delete;
+    Daemon& operator=(const Daemon&) = delete;
+
+    // binds the socket (an old socket file is replaced, the new one is 0600) and starts serving,
+    // throws if it can't bind or can't restrict the socket to this user.
+    // SIGINT / SIGTERM stop the daemon
+    void start();
+    // thread safe
+    void stop();
+    // blocks until stopped
+    void wait();
+
+private:
+    class Connection;
+
+    struct Send {
+        std::shared_ptr<Connection> from;
+        uint32_t request_id;
+        std::vector<ClientId> recipients;
+        bool envelope;
+        std::string text;
+    };
+
+    typedef std::unordered_map<ClientId, boost::system::error_code, ClientIdHash> Failures;
+
+    MessageClient& _client;
+    std::string _socket_path;
+    std::chrono::milliseconds _poll_interval;
+    boost::asio::local::stream_protocol::acceptor _acceptor;
+    boost::asio::steady_timer _poll;
+    boost::asio::signal_set _signals;
+    std::set<std::shared_ptr<Connection>> _connections;
+    std::vector<Send> _batch;   // waiting for the running batch
+    bool _batch_running;
+
+    std::mutex _stop_lock;
+    std::condition_variable _stopped_cv;
+    bool _stopped;
+
+    void accept();
+    void handle(const std::shared_ptr<Connection>& from, uint32_t request_id, uint8_t op, std::vector<uint8_t> payload);
+    void closed(const std::shared_ptr<Connection>& connection);
+
+    void submit(Send send);
+    void run_batch();
+    void fetch_public_keys(std::vector<ClientId> ids, std::shared_ptr<Failures> failed, std::function<void()> next);
+    void send_session_keys(std::vector<ClientId> ids, std::shared_ptr<Failures> failed, std::function<void()> next);
+    void send_batch(std::shared_ptr<std::vector<Send>> batch, std::shared_ptr<Failures> failed);
+
+    void schedule_poll();
+    void poll();
+    void publish(const std::vector<PulledMessage>& messages);
+
+    void shutdown();
+};
+
+#endif // DAEMON_H
@@ -1,66 +1,396 @@
 //encryption code for messages encryption 
 
 #include "encryption.h"
-#include "RSAWrapper.h"
+#include "keyExchange.h"
 #include "AESWrapper.h"
+#include "AEADWrapper.h"
 #include <string>
 #include <unordered_map>
-#include <iostream>
-#include "client.h" 
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include "clientSession.h"
+#include "threadPool.h"
 
 
-std::unordered_map<std::string, AESWrapper> symmetric_keys;
-std::unordered_map<std::string, std::string> known_public_keys;
+KeyStore<SessionKey, SessionKeyId, SessionKeyIdHash> symmetric_keys;
+KeyStore<std::string> known_public_keys;
 
-/*
 
+SessionKey::SessionKey(const unsigned char* key)
+    : aes(key, AESWrapper::DEFAULT_KEYLENGTH), aead(key, AESWrapper::DEFAULT_KEYLENGTH) {}
 
-void send_symmetric_key(const std::string& recipient_id, const std::string& public_key, ClientSession& session, const std::string& sender_id) {
-    AESWrapper aes;
-    symmetric_keys[recipient_id] = aes;
+static std::shared_ptr<SessionKey> unwrap_symmetric_key(const std::string& encrypted_key, KeyPair& keys) {
+    std::string sym_key = keys.decrypt(encrypted_key);
+    if (sym_key.size() != AESWrapper::DEFAULT_KEYLENGTH) {
+        throw std::length_error("symmetric key must be 16 bytes");
+    }
+    return std::make_shared<SessionKey>(reinterpret_cast<const unsigned char*>(sym_key.data()));
+}
+
+bool has_symmetric_key_for_user(const ClientId& owner_id, const ClientId& user_id) {
+    return find_symmetric_key(owner_id, user_id) != nullptr;
+}
+
+std::shared_ptr<SessionKey> find_symmetric_key(const ClientId& owner_id, const ClientId& user_id) {
+    return symmetric_keys.find(SessionKeyId{ owner_id, user_id });
+}
+
+
+// runs task(i) for every index on the pool, then(): on the worker that finished the last one.
+// nobody waits for the jobs
+static void for_each_on_pool(std::vector<size_t> indexes, std::function<void(size_t)> task, std::function<void()> then) {
+    ThreadPool& pool = ThreadPool::shared();
+    if (indexes.empty()) {
+        pool.submit(std::move(then));
+        return;
+    }
+    std::shared_ptr<std::atomic<size_t>> left = std::make_shared<std::atomic<size_t>>(indexes.size());
+    for (size_t i : indexes) {
+        pool.submit([task, then, left, i]() {
+            task(i);
+            if (left->fetch_sub(1) == 1) {
+                then();
+            }
+        });
+    }
+}
+
+//===========================
+// multi recipient envelope (message type 6)
+//===========================
+
+static void put_u16(std::string& out, size_t value) {
+    out.push_back(static_cast<char>((value >> 8) & 0xFF));
+    out.push_back(static_cast<char>(value & 0xFF));
+}
+
+static size_t get_u16(const std::string& in, size_t offset) {
+    return (static_cast<uint8_t>(in[offset]) << 8) | static_cast<uint8_t>(in[offset + 1]);
+}
 
-    RSAPublicWrapper rsa_pub(public_key);
-    std::string encrypted_key = rsa_pub.encrypt((const char*)aes.getKey(), AESWrapper::DEFAULT_KEYLENGTH);
+namespace {
+    struct EnvelopeState {
+        std::vector<ClientId> recipient_ids;
+        std::vector<std::string> public_keys;
+        std::string message;
+        unsigned char content_key[AESWrapper::DEFAULT_KEYLENGTH];
+        std::vector<std::string> wrapped;
+        std::mutex error_lock;
+        std::exception_ptr error;      // first failed wrap
+        std::function<void(std::exception_ptr, std::string)> done;
+    };
+}
+
+void create_envelope(const std::vector<ClientId>& recipient_ids, const std::string& message,
+    std::function<void(std::exception_ptr, std::string)> done) {
+    if (recipient_ids.empty() || recipient_ids.size() > 0xFFFF) {
+        throw std::invalid_argument("envelope needs 1..65535 recipients");
+    }
+
+    // every recipient key must be known (request 130) before the content is encrypted
+    std::shared_ptr<EnvelopeState> state = std::make_shared<EnvelopeState>();
+    for (const ClientId& id : recipient_ids) {
+        std::shared_ptr<std::string> public_key = known_public_keys.find(id);
+        if (!public_key) {
+            throw std::runtime_error("No public key for a recipient. Request it first (130).");
+        }
+        state->public_keys.push_back(*public_key);
+    }
+    state->recipient_ids = recipient_ids;
+    state->message = message;
+    state->wrapped.resize(recipient_ids.size());
+    state->done = std::move(done);
+    AESWrapper::GenerateKey(state->content_key, AESWrapper::DEFAULT_KEYLENGTH);
+
+    // the content key is wrapped for each recipient, split over the cores; the content is
+    // encrypted once, with a fresh content key, by the worker that finished the last wrap
+    size_t count = recipient_ids.size();
+    size_t chunk = (count + ThreadPool::shared().size() - 1) / ThreadPool::shared().size();
+    std::vector<size_t> starts;
+    for (size_t start = 0; start < count; start += chunk) {
+        starts.push_back(start);
+    }
+    for_each_on_pool(starts, [state, chunk](size_t start) {
+        try {
+            size_t end = std::min(start + chunk, state->public_keys.size());
+            for (size_t i = start; i < end; i++) {
+                state->wrapped[i] = wrap_symmetric_key(state->public_keys[i], state->content_key, AESWrapper::DEFAULT_KEYLENGTH);
+            }
+        }
+        catch (const std::exception&) {
+            std::lock_guard<std::mutex> lock(state->error_lock);
+            if (!state->error) {
+                state->error = std::current_exception();
+            }
+        }
+    }, [state]() {
+        if (state->error) {
+            state->done(state->error, std::string());
+            return;
+        }
+        std::string envelope;
+        try {
+            AEADWrapper aead(state->content_key, AESWrapper::DEFAULT_KEYLENGTH);
+            std::string body = aead.encrypt(state->message.c_str(), static_cast<unsigned int>(state->message.size()));
+            put_u16(envelope, state->recipient_ids.size());
+            for (size_t i = 0; i < state->recipient_ids.size(); i++) {
+                envelope.append(reinterpret_cast<const char*>(state->recipient_ids[i].data()), ClientId::SIZE);
+                put_u16(envelope, state->wrapped[i].size());
+                envelope += state->wrapped[i];
+            }
+            envelope += body;
+        }
+        catch (const std::exception&) {
+            state->done(std::current_exception(), std::string());
+            return;
+        }
+        state->done(nullptr, std::move(envelope));
+    });
+}
 
-    // Send request 603 with message_type=2, content=encrypted_key
-    MessagePayload payload;
-    memcpy(payload.recipient_id, recipient_id.c_str(), 16);
-    payload.message_type = 2;
-    payload.message_content = encrypted_key;
-    payload.content_size = encrypted_key.size();
+std::string open_envelope(const std::string& content, KeyPair& keys) {
+    if (content.size() < 2) {
+        throw std::length_error("envelope too short");
+    }
+    size_t key_size = get_u16(content, 0);
+    if (content.size() < 2 + key_size + AEADWrapper::OVERHEAD) {
+        throw std::length_error("envelope too short");
+    }
+
+    std::string content_key = keys.decrypt(content.substr(2, key_size));
+    AEADWrapper aead(reinterpret_cast<const unsigned char*>(content_key.data()), static_cast<unsigned int>(content_key.size()));
+    size_t body_offset = 2 + key_size;
+    return aead.decrypt(content.data() + body_offset, static_cast<unsigned int>(content.size() - body_offset));
+}
 
-    std::vector<uint8_t> binary_payload = message_payload_to_binary(payload);
 
-    Header header;
-    std::string sid = sender_id;
-    if (sid.size() < 16) sid.append(16 - sid.size(), '\0');
-    memcpy(header.client_id, sid.data(), 16);
-    header.version = 1;
-    header.code = 603;
-    header.payload_size = binary_payload.size();
+//===========================
+// decryption of pulled messages (2104)
+//===========================
 
-    std::vector<uint8_t> packet = header_to_binary(header);
-    packet.insert(packet.end(), binary_payload.begin(), binary_payload.end());
+static std::string decrypt_content(const PulledMessage& msg, const std::shared_ptr<SessionKey>& key, KeyPair* own_keys) {
+    try {
+        switch (msg.message_type) {
+        case MSG_SYMMETRIC_KEY_REQUEST:
+            return "Request for symmetric key";
+        case MSG_SYMMETRIC_KEY:
+            return key ? "symmetric key received" : "can't decrypt symmetric key";
+        case MSG_TEXT:
+            // clients without a key exchange send plain text
+            if (!key) {
+                return msg.message_content;
+            }
+            return key->aes.decrypt(msg.message_content.data(), static_cast<unsigned int>(msg.message_content.size()));
+        case MSG_AEAD_TEXT:
+            if (!key) {
+                return "can't decrypt message";
+            }
+            return key->aead.decrypt(msg.message_content.data(), static_cast<unsigned int>(msg.message_content.size()));
+        case MSG_ENVELOPE:
+            if (!own_keys) {
+                return "can't decrypt message (no private key loaded)";
+            }
+            return open_envelope(msg.message_content, *own_keys);
+        default:
+            return msg.message_content;
+        }
+    }
+    catch (const std::exception&) {
+        return "can't decrypt message";
+    }
+}
 
-    send_data(session.socket, packet);
+namespace {
+    struct DecryptState {
+        std::vector<PulledMessage> messages;
+        ClientId owner_id;
+        std::shared_ptr<KeyPair> own_keys;
+        std::vector<std::shared_ptr<SessionKey>> unwrapped;
+        std::vector<std::shared_ptr<SessionKey>> keys;
+        std::function<void(std::vector<PulledMessage>)> done;
+    };
 }
 
-std::string encrypt_message_for_user(const std::string& recipient_id, const std::string& message) {
-    if (symmetric_keys.find(recipient_id) == symmetric_keys.end()) {
+void decrypt_pulled_messages(std::vector<PulledMessage> messages, const ClientId& owner_id, std::shared_ptr<KeyPair> own_keys,
+    std::function<void(std::vector<PulledMessage>)> done) {
+    std::shared_ptr<DecryptState> state = std::make_shared<DecryptState>();
+    state->messages = std::move(messages);
+    state->owner_id = owner_id;
+    state->own_keys = std::move(own_keys);
+    state->unwrapped.resize(state->messages.size());
+    state->keys.resize(state->messages.size());
+    state->done = std::move(done);
+
+    std::vector<size_t> key_messages, all;
+    for (size_t i = 0; i < state->messages.size(); i++) {
+        if (state->own_keys && state->messages[i].message_type == MSG_SYMMETRIC_KEY) {
+            key_messages.push_back(i);
+        }
+        all.push_back(i);
+    }
+
+    // 3. decrypt all contents in parallel
+    std::function<void()> decrypt = [state, all]() {
+        for_each_on_pool(all, [state](size_t i) {
+            state->messages[i].message_content = decrypt_content(state->messages[i], state->keys[i], state->own_keys.get());
+        }, [state]() {
+            std::stable_sort(state->messages.begin(), state->messages.end(), [](const PulledMessage& a, const PulledMessage& b) {
+                return a.message_id < b.message_id;
+            });
+            state->done(std::move(state->messages));
+        });
+    };
+
+    // 1. unwrap every key sent in this batch, all at once (the expensive RSA / X25519 part)
+    for_each_on_pool(key_messages, [state](size_t i) {
+        try {
+            state->unwrapped[i] = unwrap_symmetric_key(state->messages[i].message_content, *state->own_keys);
+        }
+        catch (const std::exception&) {
+            // shown as "can't decrypt symmetric key"
+        }
+    }, [state, decrypt]() {
+        // 2. every message uses the last key its sender sent before it, or the stored one
+        std::unordered_map<ClientId, std::shared_ptr<SessionKey>> received;
+        for (size_t i = 0; i < state->messages.size(); i++) {
+            const ClientId& sender = state->messages[i].sender_id;
+            if (state->messages[i].message_type == MSG_SYMMETRIC_KEY) {
+                state->keys[i] = state->unwrapped[i];
+                if (state->unwrapped[i]) {
+                    received[sender] = state->unwrapped[i];
+                }
+                continue;
+            }
+            auto it = received.find(sender);
+            state->keys[i] = (it != received.end()) ? it->second : find_symmetric_key(state->owner_id, sender);
+        }
+        for (auto& key : received) {
+            store_session_key(state->owner_id, state->own_keys.get(), key.first, key.second);
+        }
+        decrypt();
+    });
+}
+
+//===========================
+// message types 1 / 2 / 5 to one peer
+//===========================
+
+std::vector<uint8_t> create_symmetric_key_request_packet(const ClientId& recipient_id, ClientSession& session) {
+    return create_message_packet(session.client_id, recipient_id, "", MSG_SYMMETRIC_KEY_REQUEST);
+}
+
+std::vector<uint8_t> create_symmetric_key_packet(const ClientId& recipient_id, ClientSession& session) {
+    std::shared_ptr<std::string> public_key = known_public_keys.find(recipient_id);
+    if (!public_key) {
+        throw std::runtime_error("No public key for this user. Request it first (130).");
+    }
+
+    // the cached key is sent again if there is one, so earlier messages stay readable
+    std::shared_ptr<SessionKey> key = find_symmetric_key(session.client_id, recipient_id);
+    if (!key) {
+        unsigned char raw_key[AESWrapper::DEFAULT_KEYLENGTH];
+        AESWrapper::GenerateKey(raw_key, AESWrapper::DEFAULT_KEYLENGTH);
+        key = std::make_shared<SessionKey>(raw_key);
+        store_session_key(session.client_id, session.keys.get(), recipient_id, key);
+    }
+
+    // wrapped with the recipient's suite (RSA-OAEP or X25519), the only public key operation per peer
+    std::string encrypted_key = wrap_symmetric_key(*public_key, key->aes.getKey(), AESWrapper::DEFAULT_KEYLENGTH);
+    return create_message_packet(session.client_id, recipient_id, encrypted_key, MSG_SYMMETRIC_KEY);
+}
+
+std::string encrypt_message_for_user(const ClientId& owner_id, const ClientId& recipient_id, const std::string& message) {
+    std::shared_ptr<SessionKey> key = find_symmetric_key(owner_id, recipient_id);
+    if (!key) {
         throw std::runtime_error("No symmetric key found for this user. Must request it first.");
     }
-    AESWrapper& aes = symmetric_keys[recipient_id];
-    return aes.encrypt(message.c_str(), message.size());
+    return key->aead.encrypt(message.c_str(), static_cast<unsigned int>(message.size()));
 }
 
-void save_received_symmetric_key(const std::string& sender_id, const std::string& encrypted_key, RSAPrivateWrapper& rsa_priv) {
-    std::string sym_key = rsa_priv.decrypt(encrypted_key);
-    AESWrapper aes((const unsigned char*)sym_key.c_str(), AESWrapper::DEFAULT_KEYLENGTH);
-    symmetric_keys[sender_id] = aes;
+
+//===========================
+// session key cache (keys.info)
+//===========================
+
+// one line per key: owner id | peer id | key sealed with a key derived from the owner's private key.
+// all fields are hex, later lines replace earlier ones.
+static const char* SESSION_KEYS_FILE = "keys.info";
+static const char* SESSION_KEYS_PURPOSE = "mmn15 session key cache";
+static std::mutex session_keys_file_lock;
+
+static std::string to_hex(const std::string& data) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c : data) {
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0x0F]);
+    }
+    return hex;
+}
+
+static std::string from_hex(const std::string& hex) {
+    std::string data;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        data.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return data;
 }
 
-bool has_symmetric_key_for_user(const std::string& user_id) {
-    return symmetric_keys.find(user_id) != symmetric_keys.end();
+static std::string cache_key(KeyPair& keys) {
+    return keys.deriveKey(SESSION_KEYS_PURPOSE, AEADWrapper::DEFAULT_KEYLENGTH);
 }
 
-*/
+void store_session_key(const ClientId& owner_id, KeyPair* own_keys, const ClientId& peer_id, std::shared_ptr<SessionKey> key) {
+    symmetric_keys.insert(SessionKeyId{ owner_id, peer_id }, key);
+    if (!own_keys || owner_id.empty()) {
+        return;
+    }
+
+    std::string sealing_key = cache_key(*own_keys);
+    AEADWrapper sealer(reinterpret_cast<const unsigned char*>(sealing_key.data()), AEADWrapper::DEFAULT_KEYLENGTH);
+    std::string sealed = sealer.encrypt(reinterpret_cast<const char*>(key->aes.getKey()), AESWrapper::DEFAULT_KEYLENGTH);
+
+    std::lock_guard<std::mutex> lock(session_keys_file_lock);
+    std::ofstream file(SESSION_KEYS_FILE, std::ios::app);
+    if (!file.is_open()) {
+        return;  // the key stays in memory, only the next run has to exchange it again
+    }
+    file << owner_id.to_hex() << " " << peer_id.to_hex() << " " << to_hex(sealed) << "\n";
+}
+
+size_t load_session_keys(const ClientId& owner_id, KeyPair& keys) {
+    std::string sealing_key = cache_key(keys);
+    AEADWrapper sealer(reinterpret_cast<const unsigned char*>(sealing_key.data()), AEADWrapper::DEFAULT_KEYLENGTH);
+    std::string owner = owner_id.to_hex();
+
+    std::unordered_map<SessionKeyId, std::shared_ptr<SessionKey>, SessionKeyIdHash> loaded;
+    {
+        std::lock_guard<std::mutex> lock(session_keys_file_lock);
+        std::ifstream file(SESSION_KEYS_FILE);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string line_owner, peer_id, sealed;
+            if (!(fields >> line_owner >> peer_id >> sealed) || line_owner != owner) {
+                continue;
+            }
+            try {
+                std::string raw = from_hex(sealed);
+                std::string key = sealer.decrypt(raw.data(), static_cast<unsigned int>(raw.size()));
+                loaded[SessionKeyId{ owner_id, ClientId::from_hex(peer_id) }] = std::make_shared<SessionKey>(reinterpret_cast<const unsigned char*>(key.data()));
+            }
+            catch (const std::exception&) {
+                // line of another key pair or damaged, skip it
+            }
+        }
+    }
+
+    symmetric_keys.insert_all(loaded);
+    return loaded.size();
+}
@@ -3,19 +3,73 @@
 #ifndef ENCRYPTION_H
 #define ENCRYPTION_H
 
+#include <exception>
+#include <functional>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <vector>
 #include "AESWrapper.h"
-#include "client.h"
-#include "RSAWrapper.h"
+#include "AEADWrapper.h"
+#include "clientSession.h"
+#include "keyExchange.h"
+#include "keyStore.h"
 
-extern std::unordered_map<std::string, AESWrapper> symmetric_keys;
-extern std::unordered_map<std::string, std::string> known_public_keys;
+// symmetric key shared with one peer, in the two forms messages use it
+struct SessionKey {
+    AESWrapper aes;    // message type 3 (AES-CBC)
+    AEADWrapper aead;  // message type 5
 
-std::string request_public_key(const std::string& recipient_id, ClientSession& session);
-void send_symmetric_key(const std::string& recipient_id, const std::string& public_key, ClientSession& session, const std::string& sender_id);
-std::string encrypt_message_for_user(const std::string& recipient_id, const std::string& message);
-void save_received_symmetric_key(const std::string& sender_id, const std::string& encrypted_key, RSAPrivateWrapper& rsa_priv);
-bool has_symmetric_key_for_user(const std::string& user_id);
+    explicit SessionKey(const unsigned char* key);
+};
+
+// a session key belongs to one of our accounts (owner) and one peer: accounts hosted in the
+// same process never see each other's keys
+struct SessionKeyId {
+    ClientId owner;
+    ClientId peer;
+
+    bool operator==(const SessionKeyId& other) const { return owner == other.owner && peer == other.peer; }
+};
+
+struct SessionKeyIdHash {
+    size_t operator()(const SessionKeyId& id) const {
+        return ClientIdHash()(id.owner) ^ (ClientIdHash()(id.peer) * 0x9E3779B97F4A7C15ULL);
+    }
+};
+
+// shared by all sessions and worker threads of the process, see keyStore.h
+extern KeyStore<SessionKey, SessionKeyId, SessionKeyIdHash> symmetric_keys;
+extern KeyStore<std::string> known_public_keys;   // public keys are the same for every account
+
+// message type 1: ask a peer for its symmetric key
+std::vector<uint8_t> create_symmetric_key_request_packet(const ClientId& recipient_id, ClientSession& session);
+// message type 2: the session key for a peer (created on first use), wrapped with its public key
+std::vector<uint8_t> create_symmetric_key_packet(const ClientId& recipient_id, ClientSession& session);
+// content of message type 5, encrypted with the cached session key
+std::string encrypt_message_for_user(const ClientId& owner_id, const ClientId& recipient_id, const std::string& message);
+bool has_symmetric_key_for_user(const ClientId& owner_id, const ClientId& user_id);
+std::shared_ptr<SessionKey> find_symmetric_key(const ClientId& owner_id, const ClientId& user_id);
+
+// session keys are cached in keys.info (sealed with a key derived from the private key),
+// so after a restart no public key operation is needed for peers we already share a key with
+void store_session_key(const ClientId& owner_id, KeyPair* own_keys, const ClientId& peer_id, std::shared_ptr<SessionKey> key);
+size_t load_session_keys(const ClientId& owner_id, KeyPair& keys);
+
+// message type 6: content encrypted once, content key wrapped for every recipient.
+// uploaded content: count (2) | per recipient: id (16) | key size (2) | wrapped key | aead body
+// delivered content (server keeps only the recipient's own key): key size (2) | wrapped key | aead body
+// throws right away for a bad recipient count or a missing public key; the wraps and the encryption
+// run on the thread pool and done gets the envelope (or what went wrong) on a pool thread
+void create_envelope(const std::vector<ClientId>& recipient_ids, const std::string& message,
+    std::function<void(std::exception_ptr, std::string)> done);
+std::string open_envelope(const std::string& content, KeyPair& keys);
+
+// decrypts a 2104 batch on the thread pool: key unwraps (type 2) first, then every
+// text with the key its sender had at that point. content of each message is replaced
+// by what the user sees. nothing waits for the pool: done gets the messages in message ID
+// order, on the pool thread that finished last. owner_id / own_keys are the receiving
+// session's, copied so the pool never reads the session itself.
+void decrypt_pulled_messages(std::vector<PulledMessage> messages, const ClientId& owner_id, std::shared_ptr<KeyPair> own_keys,
+    std::function<void(std::vector<PulledMessage>)> done);
 
 #endif // ENCRYPTION_H
@@ -0,0 +1,128 @@
+// ring buffer frame decoder for responses read from the server
+
+#include "frameDecoder.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+
+static size_t round_up_pow2(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+FrameDecoder::FrameDecoder(size_t capacity, size_t max_frame_size)
+    : _ring(round_up_pow2(max(capacity, sizeof(ResponseHeader)))), _head(0), _tail(0), _release(0),
+    _max_frame_size(max_frame_size) {}
+
+size_t FrameDecoder::buffered() const {
+    return static_cast<size_t>(_tail - _head);
+}
+
+void FrameDecoder::clear() {
+    _head = _tail = 0;
+    _release = 0;
+}
+
+void FrameDecoder::release() {
+    _head += _release;
+    _release = 0;
+    if (_head == _tail) {
+        _head = _tail = 0;  // empty: the next read starts at the front, in one piece
+    }
+}
+
+array<boost::asio::mutable_buffer, 2> FrameDecoder::prepare(size_t min_free) {
+    release();
+    if (_ring.size() - buffered() < min_free) {
+        grow(buffered() + min_free);
+    }
+    size_t free_bytes = _ring.size() - buffered();
+    size_t start = static_cast<size_t>(_tail & mask());
+    size_t first = min(free_bytes, _ring.size() - start);
+    return { boost::asio::buffer(_ring.data() + start, first),
+        boost::asio::buffer(_ring.data(), free_bytes - first) };
+}
+
+void FrameDecoder::commit(size_t bytes) {
+    _tail += min(bytes, _ring.size() - buffered());
+}
+
+bool FrameDecoder::peek_header(ResponseHeader& header) {
+    release();
+    if (buffered() < sizeof(ResponseHeader)) {
+        return false;
+    }
+    uint8_t raw[sizeof(ResponseHeader)];
+    copy_out(_head, raw, sizeof(raw));
+    header = parse_response_header(raw);
+    return true;
+}
+
+const uint8_t* FrameDecoder::contiguous(size_t& size) const {
+    uint64_t head = _head + _release;
+    size_t start = static_cast<size_t>(head & mask());
+    size = min(static_cast<size_t>(_tail - head), _ring.size() - start);
+    return _ring.data() + start;
+}
+
+void FrameDecoder::consume(size_t bytes) {
+    release();
+    _head += min(bytes, buffered());
+    release();
+}
+
+bool FrameDecoder::next(FrameView& frame) {
+    ResponseHeader header;
+    if (!peek_header(header)) {
+        return false;
+    }
+    if (header.payload_size > _max_frame_size) {
+        throw length_error("response frame of " + to_string(header.payload_size) + " bytes is over the limit");
+    }
+
+    size_t total = sizeof(ResponseHeader) + header.payload_size;
+    if (buffered() < total) {
+        if (total > _ring.size()) {
+            grow(total);  // make room so the rest can be read
+        }
+        return false;
+    }
+
+    frame.header = header;
+    frame.payload_size = header.payload_size;
+    size_t start = static_cast<size_t>((_head + sizeof(ResponseHeader)) & mask());
+    if (start + header.payload_size <= _ring.size()) {
+        frame.payload = _ring.data() + start;
+    }
+    else {
+        // payload wraps around the end of the ring
+        _scratch.resize(header.payload_size);
+        copy_out(_head + sizeof(ResponseHeader), _scratch.data(), header.payload_size);
+        frame.payload = _scratch.data();
+    }
+    _release = total;
+    return true;
+}
+
+void FrameDecoder::copy_out(uint64_t pos, uint8_t* dst, size_t n) const {
+    size_t start = static_cast<size_t>(pos & mask());
+    size_t first = min(n, _ring.size() - start);
+    memcpy(dst, _ring.data() + start, first);
+    memcpy(dst + first, _ring.data(), n - first);
+}
+
+void FrameDecoder::grow(size_t needed) {
+    vector<uint8_t> bigger(round_up_pow2(needed));
+    size_t size = buffered();
+    copy_out(_head, bigger.data(), size);
+    _ring.swap(bigger);
+    _head = 0;
+    _tail = size;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+#include <boost/asio.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "network.h"
+
+// one response frame (7 byte header + payload) as a view into the decoder.
+// valid until the next call to next(), prepare() or clear() on that decoder.
+struct FrameView {
+    ResponseHeader header;
+    const uint8_t* payload;
+    size_t payload_size;
+};
+
+// receive ring buffer of one connection.
+// the socket reads as much as fits with one read_some into prepare(), next() then hands out
+// every complete frame in the buffer; a frame cut between reads waits for the rest.
+// frames that don't fit grow the ring (power of two), frames that wrap around the end of
+// the ring are copied once into a scratch buffer so the payload view stays contiguous.
+// a frame announcing more than max_frame_size payload bytes is refused (std::length_error)
+// before anything is allocated for it; the connection can't be used after that.
+// big payloads that are parsed as they arrive (2101 users list, 2104 messages) skip next() and
+// stream through peek_header() / contiguous() / consume(), so they never have to fit in the ring
+// and the limit applies to each of their records (one pulled message), not to the whole payload.
+class FrameDecoder {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024;
+    static const size_t MIN_READ = 4 * 1024;
+    static const size_t DEFAULT_MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+    explicit FrameDecoder(size_t capacity = DEFAULT_CAPACITY, size_t max_frame_size = DEFAULT_MAX_FRAME_SIZE);
+
+    void set_max_frame_size(size_t max_frame_size) { _max_frame_size = max_frame_size; }
+    size_t max_frame_size() const { return _max_frame_size; }
+
+    // free space for the next read_some, at least min_free bytes (two parts when it wraps)
+    std::array<boost::asio::mutable_buffer, 2> prepare(size_t min_free = MIN_READ);
+
+    // bytes written into the prepared space
+    void commit(size_t bytes);
+
+    // next complete frame, false when more bytes are needed
+    bool next(FrameView& frame);
+
+    // header of the next frame without taking it, false until all 7 bytes are buffered
+    bool peek_header(ResponseHeader& header);
+
+    // streaming: the buffered bytes that are contiguous in the ring, and dropping bytes once used
+    const uint8_t* contiguous(size_t& size) const;
+    void consume(size_t bytes);
+
+    size_t buffered() const;
+
+    // drops everything, e.g. after reconnecting
+    void clear();
+
+private:
+    std::vector<uint8_t> _ring;
+    uint64_t _head;      // read position (counts all bytes ever read, masked on access)
+    uint64_t _tail;      // write position
+    size_t _release;     // size of the frame handed out last, consumed on the next call
+    size_t _max_frame_size;
+    std::vector<uint8_t> _scratch;
+
+    size_t mask() const { return _ring.size() - 1; }
+    void release();
+    void copy_out(uint64_t pos, uint8_t* dst, size_t n) const;
+    void grow(size_t needed);
+};
+
+#endif // FRAME_DECODER_H
@@ -0,0 +1,93 @@
+// key setup for the supported cipher suites (RSA-OAEP and X25519)
+
+#include "keyExchange.h"
+#include "Base64Wrapper.h"
+#include <hkdf.h>
+#include <sha.h>
+#include <algorithm>
+
+
+static const char X25519_TAG = static_cast<char>(KeySuite::X25519);
+static const size_t X25519_WIRE_SIZE = 1 + X25519PublicWrapper::KEYSIZE;
+
+// my.info is line based, so the stored key must not contain the encoder's line breaks
+static std::string one_line(std::string base64) {
+    base64.erase(std::remove(base64.begin(), base64.end(), '\n'), base64.end());
+    return base64;
+}
+
+
+KeySuite public_key_suite(const std::string& wire_key) {
+    // base64 text never starts with the tag byte, so legacy RSA keys are recognised as such
+    if (wire_key.size() == X25519_WIRE_SIZE && wire_key[0] == X25519_TAG) {
+        return KeySuite::X25519;
+    }
+    return KeySuite::RSA_1024;
+}
+
+std::string wrap_symmetric_key(const std::string& wire_key, const unsigned char* key, unsigned int length) {
+    if (public_key_suite(wire_key) == KeySuite::X25519) {
+        X25519PublicWrapper x25519_pub(wire_key.substr(1));
+        return x25519_pub.encrypt(reinterpret_cast<const char*>(key), length);
+    }
+    RSAPublicWrapper rsa_pub(Base64Wrapper::decode(wire_key));
+    return rsa_pub.encrypt(reinterpret_cast<const char*>(key), length);
+}
+
+
+KeyPair::KeyPair(KeySuite suite) : _suite(suite) {
+    if (suite == KeySuite::X25519) {
+        _x25519 = std::make_unique<X25519PrivateWrapper>();
+    }
+    else {
+        _rsa = std::make_unique<RSAPrivateWrapper>();
+    }
+}
+
+KeyPair::KeyPair(const std::string& stored_key) {
+    std::string raw = Base64Wrapper::decode(stored_key);
+    // RSA keys are stored as plain DER (starts with 0x30), X25519 keys carry the suite tag
+    if (raw.size() == X25519_WIRE_SIZE && raw[0] == X25519_TAG) {
+        _suite = KeySuite::X25519;
+        _x25519 = std::make_unique<X25519PrivateWrapper>(raw.substr(1));
+    }
+    else {
+        _suite = KeySuite::RSA_1024;
+        _rsa = std::make_unique<RSAPrivateWrapper>(raw);
+    }
+}
+
+KeySuite KeyPair::suite() const {
+    return _suite;
+}
+
+std::string KeyPair::getPublicKey() const {
+    if (_suite == KeySuite::X25519) {
+        return X25519_TAG + _x25519->getPublicKey();
+    }
+    return Base64Wrapper::encode(_rsa->getPublicKey());
+}
+
+std::string KeyPair::getPrivateKey() const {
+    if (_suite == KeySuite::X25519) {
+        return one_line(Base64Wrapper::encode(X25519_TAG + _x25519->getPrivateKey()));
+    }
+    return one_line(Base64Wrapper::encode(_rsa->getPrivateKey()));
+}
+
+std::string KeyPair::decrypt(const std::string& wrapped) {
+    if (_suite == KeySuite::X25519) {
+        return _x25519->decrypt(wrapped);
+    }
+    return _rsa->decrypt(wrapped);
+}
+
+std::string KeyPair::deriveKey(const std::string& purpose, unsigned int length) const {
+    std::string secret = (_suite == KeySuite::X25519) ? _x25519->getPrivateKey() : _rsa->getPrivateKey();
+    std::string derived(length, '\0');
+    CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+    hkdf.DeriveKey(reinterpret_cast<CryptoPP::byte*>(&derived[0]), derived.size(),
+        reinterpret_cast<const CryptoPP::byte*>(secret.data()), secret.size(), NULL, 0,
+        reinterpret_cast<const CryptoPP::byte*>(purpose.data()), purpose.size());
+    return derived;
+}
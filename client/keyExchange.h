@@ -0,0 +1,52 @@
+#pragma once
+#ifndef KEY_EXCHANGE_H
+#define KEY_EXCHANGE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "RSAWrapper.h"
+#include "X25519Wrapper.h"
+
+// asymmetric cipher suites a client can register with.
+// the suite travels inside the public key field (600 / 2102) so the server does not need to know it:
+//  - RSA_1024: base64 text of the key, as the original clients send it
+//  - X25519:   one tag byte followed by the 32 raw key bytes
+enum class KeySuite : uint8_t {
+    RSA_1024 = 0,
+    X25519 = 1
+};
+
+// suite used for new registrations
+const KeySuite DEFAULT_KEY_SUITE = KeySuite::X25519;
+
+// which suite a public key received from the server (2102) belongs to
+KeySuite public_key_suite(const std::string& wire_key);
+
+// wrap a symmetric key for the owner of wire_key (content of message type 2)
+std::string wrap_symmetric_key(const std::string& wire_key, const unsigned char* key, unsigned int length);
+
+// the client's own key pair, whichever suite it was generated with
+class KeyPair {
+public:
+    explicit KeyPair(KeySuite suite);  // generates a new pair
+    explicit KeyPair(const std::string& stored_key);  // loads the base64 private key saved in my.info
+
+    KeySuite suite() const;
+
+    std::string getPublicKey() const;  // wire form, sent in the 600 payload
+    std::string getPrivateKey() const;  // base64 form, saved in my.info
+
+    // unwrap a symmetric key received in message type 2
+    std::string decrypt(const std::string& wrapped);
+
+    // secret derived from the private key, for local data only this client may read
+    std::string deriveKey(const std::string& purpose, unsigned int length) const;
+
+private:
+    KeySuite _suite;
+    std::unique_ptr<RSAPrivateWrapper> _rsa;
+    std::unique_ptr<X25519PrivateWrapper> _x25519;
+};
+
+#endif // KEY_EXCHANGE_H
@@ -0,0 +1,134 @@
+#pragma once
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "clientId.h"
+
+// concurrent map from an id (a client id, or owner + peer for session keys) to a shared value.
+// read mostly: readers load the current snapshot of a shard and never take the shard lock, so
+// they don't wait for a writer's copy. the atomic shared_ptr load itself is not lock-free in the
+// standard libraries we build with (a short internal lock around the reference count).
+// writers (rare - a new peer or a new key) copy the shard's map under the shard lock,
+// change the copy and publish it; readers still holding the old snapshot keep it alive.
+// bulk loads go through insert_all, which copies and publishes each shard once.
+template <class Value, class Key = ClientId, class Hash = ClientIdHash>
+class KeyStore {
+public:
+    static const size_t SHARDS = 64;
+
+    KeyStore() {
+        for (Shard& shard : _shards) {
+            publish(shard, std::make_shared<const Map>());
+        }
+    }
+
+    KeyStore(const KeyStore&) = delete;
+    KeyStore& operator=(const KeyStore&) = delete;
+
+    std::shared_ptr<Value> find(const Key& id) const {
+        size_t hash = Hash()(id);
+        std::shared_ptr<const Map> map = snapshot(shard_of(hash));
+        auto it = map->find(id);
+        return it == map->end() ? nullptr : it->second;
+    }
+
+    void insert(const Key& id, std::shared_ptr<Value> value) {
+        Shard& shard = shard_of(Hash()(id));
+        std::lock_guard<std::mutex> lock(shard.write_lock);
+        auto map = std::make_shared<Map>(*snapshot(shard));
+        (*map)[id] = std::move(value);
+        publish(shard, std::move(map));
+    }
+
+    // entries: (id, value) pairs. every shard touched is copied and published once
+    template <class Entries>
+    void insert_all(const Entries& entries) {
+        std::vector<std::vector<const typename Entries::value_type*>> by_shard(SHARDS);
+        for (const auto& entry : entries) {
+            by_shard[shard_index(Hash()(entry.first))].push_back(&entry);
+        }
+        for (size_t i = 0; i < SHARDS; i++) {
+            if (by_shard[i].empty()) {
+                continue;
+            }
+            Shard& shard = _shards[i];
+            std::lock_guard<std::mutex> lock(shard.write_lock);
+            auto map = std::make_shared<Map>(*snapshot(shard));
+            for (const auto* entry : by_shard[i]) {
+                (*map)[entry->first] = entry->second;
+            }
+            publish(shard, std::move(map));
+        }
+    }
+
+    bool erase(const Key& id) {
+        Shard& shard = shard_of(Hash()(id));
+        std::lock_guard<std::mutex> lock(shard.write_lock);
+        std::shared_ptr<const Map> current = snapshot(shard);
+        if (current->find(id) == current->end()) {
+            return false;
+        }
+        auto map = std::make_shared<Map>(*current);
+        map->erase(id);
+        publish(shard, std::move(map));
+        return true;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const Shard& shard : _shards) {
+            total += snapshot(shard)->size();
+        }
+        return total;
+    }
+
+private:
+    typedef std::unordered_map<Key, std::shared_ptr<Value>, Hash> Map;
+
+    struct Shard {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        std::atomic<std::shared_ptr<const Map>> map;
+#else
+        std::shared_ptr<const Map> map;  // accessed only through std::atomic_load / atomic_store
+#endif
+        std::mutex write_lock;
+    };
+
+    Shard _shards[SHARDS];
+
+    // the low bits pick the bucket inside the shard's map, the high bits pick the shard
+    static size_t shard_index(size_t hash) {
+        return (hash >> (sizeof(size_t) * 8 - 6)) % SHARDS;
+    }
+
+    Shard& shard_of(size_t hash) {
+        return _shards[shard_index(hash)];
+    }
+
+    const Shard& shard_of(size_t hash) const {
+        return _shards[shard_index(hash)];
+    }
+
+    static std::shared_ptr<const Map> snapshot(const Shard& shard) {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        return shard.map.load(std::memory_order_acquire);
+#else
+        return std::atomic_load_explicit(&shard.map, std::memory_order_acquire);
+#endif
+    }
+
+    static void publish(Shard& shard, std::shared_ptr<const Map> map) {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        shard.map.store(std::move(map), std::memory_order_release);
+#else
+        std::atomic_store_explicit(&shard.map, std::move(map), std::memory_order_release);
+#endif
+    }
+};
+
+#endif // KEY_STORE_H
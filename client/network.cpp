@@ -6,11 +6,15 @@ This source file implements the network-related functions
 
 
 #include "network.h"
+#include "frameDecoder.h"
+#include "sendQueue.h"
 #include <boost/asio.hpp>  
 #include <iostream>
 #include <cstring> 
 #include <string>
 #include <cstddef>
+#include <stdexcept>
+#include <algorithm>
 
 
 
@@ -18,9 +22,6 @@ using namespace std;
 
 using boost::asio::ip::tcp;
 
-// Declare the io_context and socket as global
-boost::asio::io_context io_context; 
-
 //================================
 //requests to server - data to binary
 //================================
@@ -92,7 +93,7 @@ vector<uint8_t> create_registration_packet(const string& username, const std::st
     RegistrationPayload payload;
 
     // header information
-    std::array<uint8_t, 16> client_id = { 0 };  // Zero-initialized for now
+    memset(header.client_id, 0, sizeof(header.client_id));  // no id before registration
     header.version = 1;
     header.code = 600;  // Registration code
     header.payload_size = sizeof(payload.name_length) + username.size() + sizeof(payload.public_key_length) + public_key.size();
@@ -113,14 +114,9 @@ vector<uint8_t> create_registration_packet(const string& username, const std::st
     return packet;
 }
 
-vector<uint8_t> create_get_users_packet(const string& id) {
+vector<uint8_t> create_get_users_packet(const ClientId& id) {
     Header header;
-    string cid = id;
-    if (cid.size() < 16)
-        cid.append(16 - cid.size(), '\0');
-    else if (cid.size() > 16)
-        cid = cid.substr(0, 16);
-    memcpy(header.client_id, cid.data(), 16);
+    memcpy(header.client_id, id.data(), ClientId::SIZE);
 
     header.version = 1;
     header.code = 601;  // users list request code.
@@ -131,18 +127,14 @@ vector<uint8_t> create_get_users_packet(const string& id) {
     return packet;
 }
 
-vector<uint8_t> create_get_public_key_packet(const string& sender_id, const string& recipient_id) {
+vector<uint8_t> create_get_public_key_packet(const ClientId& sender_id, const ClientId& recipient_id) {
     Header header;
-    string cid = sender_id;
-    if (cid.size() < 16) cid.append(16 - cid.size(), '\0');
-    memcpy(header.client_id, cid.data(), 16);
+    memcpy(header.client_id, sender_id.data(), ClientId::SIZE);
 
     header.version = 1;
     header.code = 602; // request public key
 
-    string rid = recipient_id;
-    if (rid.size() < 16) rid.append(16 - rid.size(), '\0');
-    vector<uint8_t> payload(rid.begin(), rid.end());
+    vector<uint8_t> payload(recipient_id.data(), recipient_id.data() + ClientId::SIZE);
 
     header.payload_size = payload.size();
 
@@ -153,20 +145,18 @@ vector<uint8_t> create_get_public_key_packet(const string& sender_id, const stri
 
 
 
-vector<uint8_t> create_message_packet(const string& sender_id, const string& recipient, const string& message, uint8_t m_type) {
+vector<uint8_t> create_message_packet(const ClientId& sender_id, const ClientId& recipient, const string& message, uint8_t m_type) {
     Header header;
     MessagePayload payload;
-    string cid = sender_id;
-    string rid = recipient;
 
     header.version = 1;
     header.code = 603;  
-    memcpy(header.client_id, cid.data(), 16);
+    memcpy(header.client_id, sender_id.data(), ClientId::SIZE);
 
     payload.message_type = m_type;
     payload.message_content = message;
     payload.content_size = message.size();
-    memcpy(payload.recipient_id, rid.data(), 16);
+    memcpy(payload.recipient_id, recipient.data(), ClientId::SIZE);
 
     
     vector<uint8_t> payload_binary = message_payload_to_binary(payload);
@@ -180,14 +170,9 @@ vector<uint8_t> create_message_packet(const string& sender_id, const string& rec
 }
 
 
-vector<uint8_t> create_pull_messages_packet(const string& client_id) {
+vector<uint8_t> create_pull_messages_packet(const ClientId& client_id) {
     Header header;
-    string cid = client_id;
-    if (cid.size() < 16)
-        cid.append(16 - cid.size(), '\0');
-    else if (cid.size() > 16)
-        cid = cid.substr(0, 16);
-    memcpy(header.client_id, cid.data(), 16);
+    memcpy(header.client_id, client_id.data(), ClientId::SIZE);
 
     header.version = 1;
     header.code = 604;
@@ -202,76 +187,240 @@ vector<uint8_t> create_pull_messages_packet(const string& client_id) {
 //response from server
 //===========================
 
-Response read_response(tcp::socket& socket) {
-    // create buffer: read exactly the size of the Header (which is 1+2+4 = 23 bytes).
-    vector<uint8_t> headerBuf(sizeof(ResponseHeader));
+// 2104 record: sender id (16) | message id (4) | message type (1) | content size (4) | content
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+PullMessageParser::PullMessageParser(size_t max_message_size)
+    : _max_message_size(max_message_size), _header(), _header_bytes(0), _content_size(0) {}
+
+void PullMessageParser::feed(const uint8_t* data, size_t size, const PulledMessageHandler& handler) {
+    while (size > 0) {
+        if (_header_bytes < RECORD_HEADER_SIZE) {
+            size_t n = min(size, RECORD_HEADER_SIZE - _header_bytes);
+            memcpy(_header + _header_bytes, data, n);
+            _header_bytes += n;
+            data += n;
+            size -= n;
+            if (_header_bytes < RECORD_HEADER_SIZE) {
+                break;
+            }
+            _current.sender_id = ClientId(_header);
+            _current.message_id = read_u32(_header + 16);
+            _current.message_type = _header[20];
+            _content_size = read_u32(_header + 21);
+            if (_content_size > _max_message_size) {
+                throw length_error("pulled message of " + to_string(_content_size) + " bytes is over the limit");
+            }
+            _current.message_content.clear();
+            _current.message_content.reserve(_content_size);
+        }
+
+        size_t n = min(size, _content_size - _current.message_content.size());
+        _current.message_content.append(reinterpret_cast<const char*>(data), n);
+        data += n;
+        size -= n;
+        if (_current.message_content.size() == _content_size) {
+            handler(move(_current));
+            _current = PulledMessage();
+            _header_bytes = 0;
+            _content_size = 0;
+        }
+    }
+}
+
+// split a whole 2104 payload into its messages
+vector<PulledMessage> parse_pull_messages_payload(const vector<uint8_t>& payload) {
+    vector<PulledMessage> messages;
+    PullMessageParser parser(payload.size());
+    parser.feed(payload.data(), payload.size(), [&messages](PulledMessage&& msg) {
+        messages.push_back(move(msg));
+    });
+    if (!parser.idle()) {
+        cerr << "Error: message content exceeds payload size\n";
+    }
+    return messages;
+}
 
-    boost::asio::read(socket, boost::asio::buffer(headerBuf.data(), headerBuf.size()));
+void UserListParser::feed(const uint8_t* data, size_t size, const UserRecordHandler& handler) {
+    if (_buffered > 0) {
+        size_t n = min(size, USER_RECORD_SIZE - _buffered);
+        memcpy(_record + _buffered, data, n);
+        _buffered += n;
+        data += n;
+        size -= n;
+        if (_buffered < USER_RECORD_SIZE) {
+            return;
+        }
+        handler(_record);
+        _buffered = 0;
+    }
+    for (; size >= USER_RECORD_SIZE; data += USER_RECORD_SIZE, size -= USER_RECORD_SIZE) {
+        handler(data);
+    }
+    memcpy(_record, data, size);
+    _buffered = size;
+}
 
+ResponseHeader parse_response_header(const uint8_t* data) {
     // copy the raw bytes into a Header struct
     ResponseHeader rawHeader;
-    memcpy(&rawHeader, headerBuf.data(), sizeof(ResponseHeader)); //destination, source, number of bytes to copy 
+    memcpy(&rawHeader, data, sizeof(ResponseHeader)); //destination, source, number of bytes to copy 
 
     // convert endians
     rawHeader.code = ntohs(rawHeader.code);
     rawHeader.payload_size = ntohl(rawHeader.payload_size);
+    return rawHeader;
+}
 
-   // cout << "Decoded header from server: version=" << (int)rawHeader.version
-   //     << ", code=" << rawHeader.code
-   //     << ", payload_size=" << rawHeader.payload_size << endl;
-
-    // read the payload (if any)
-    std::vector<uint8_t> payload;
-    if (rawHeader.payload_size > 0) {
-        //cout << "payload is greater than 0" << "\n";
-        payload.resize(rawHeader.payload_size);
-        boost::asio::read(socket, boost::asio::buffer(payload.data(), payload.size()));
-    }
-    else {
-        cout << "payload is size = 0" << "\n";
-    }
-
-    // create response - raw header and payload
+static Response to_response(const FrameView& frame) {
     Response resp;
-    resp.header = rawHeader;
-    resp.payload = std::move(payload);
+    resp.header = frame.header;
+    resp.payload.assign(frame.payload, frame.payload + frame.payload_size);
     return resp;
 }
 
+// small start, the decoder grows for big responses. thousands of sessions may be waiting at once
+static const size_t EXCHANGE_BUFFER_SIZE = 4 * 1024;
+
+// state of one async_exchange, kept alive by the pending handlers.
+// the timer shares the socket's executor, so finish() never races with an i/o handler.
+struct Exchange {
+    tcp::socket& socket;
+    boost::asio::steady_timer deadline;
+    vector<uint8_t> packet;
+    ExchangeContext context;
+    unique_ptr<FrameDecoder> own_frames;
+    FrameDecoder* frames;
+    unique_ptr<PullMessageParser> parser;  // set while a 2104 payload is streamed
+    unique_ptr<UserListParser> users;      // set while a 2101 payload is streamed
+    ResponseHeader header;
+    size_t remaining;
+    ResponseHandler handler;
+    bool done;
+
+    Exchange(tcp::socket& s, vector<uint8_t> p, ResponseHandler h, ExchangeContext c)
+        : socket(s), deadline(s.get_executor()), packet(move(p)), context(move(c)), frames(context.frames),
+        header(), remaining(0), handler(move(h)), done(false) {
+        if (!frames) {
+            own_frames = make_unique<FrameDecoder>(EXCHANGE_BUFFER_SIZE);
+            frames = own_frames.get();
+        }
+    }
 
+    void finish(const boost::system::error_code& ec, Response resp = Response()) {
+        if (done) {
+            return;
+        }
+        done = true;
+        deadline.cancel();
+        handler(ec, move(resp));
+    }
+};
+
+// takes what the decoder holds: a whole frame, or the next part of a streamed 2104 / 2101 payload.
+// returns false when more bytes must be read first
+static bool take_buffered(shared_ptr<Exchange> ex) {
+    if (!ex->parser && !ex->users) {
+        ResponseHeader header;
+        bool streamed = ex->frames->peek_header(header)
+            && ((header.code == 2104 && ex->context.on_message) || (header.code == 2101 && ex->context.on_user));
+        if (streamed) {
+            ex->frames->consume(sizeof(ResponseHeader));
+            ex->header = header;
+            ex->remaining = header.payload_size;
+            if (header.code == 2104) {
+                ex->parser = make_unique<PullMessageParser>(ex->frames->max_frame_size());
+            }
+            else {
+                ex->users = make_unique<UserListParser>();
+            }
+        }
+        else {
+            FrameView frame;
+            if (!ex->frames->next(frame)) {
+                return false;
+            }
+            ex->finish(boost::system::error_code(), to_response(frame));
+            return true;
+        }
+    }
 
-//===========================
-// connection to server
-//===========================
-
-void connect_to_server(tcp::socket& socket, const string& server_ip, int server_port) {
-    try {
-        // resolve the server address and port
-        tcp::resolver resolver(io_context);
-        auto endpoints = resolver.resolve(server_ip, to_string(server_port));
-
-        // connect to the server
-        boost::asio::connect(socket, endpoints);
-        cout << "Connected to server at " << server_ip << ":" << server_port << endl;
+    while (ex->remaining > 0 && ex->frames->buffered() > 0) {
+        size_t n;
+        const uint8_t* data = ex->frames->contiguous(n);
+        n = min(n, ex->remaining);
+        if (ex->parser) {
+            ex->parser->feed(data, n, ex->context.on_message);
+        }
+        else {
+            ex->users->feed(data, n, ex->context.on_user);
+        }
+        ex->frames->consume(n);
+        ex->remaining -= n;
     }
-    catch (exception& e) {
-        cerr << "Error connecting to server: " << e.what() << endl;
+    if (ex->remaining > 0) {
+        return false;
     }
+    if (ex->parser ? !ex->parser->idle() : !ex->users->idle()) {
+        throw length_error("streamed payload ends inside a record");
+    }
+    Response resp;
+    resp.header = ex->header;
+    ex->finish(boost::system::error_code(), move(resp));
+    return true;
 }
 
-void send_data(tcp::socket& socket, const vector<uint8_t>& data) {
+static void read_frame(shared_ptr<Exchange> ex) {
     try {
-        // send the binary info to the server
-        boost::asio::write(socket, boost::asio::buffer(data.data(), data.size()));
-        //cout << "sent: " << data.size() << " bytes of data" << endl;
+        if (take_buffered(ex)) {
+            return;
+        }
     }
-    catch (exception& e) {  
-        cerr << "Error sending data: " << e.what() << endl;
+    catch (const length_error&) {
+        return ex->finish(boost::asio::error::message_size);
     }
+    ex->socket.async_read_some(ex->frames->prepare(), [ex](const boost::system::error_code& ec, size_t n) {
+        if (ec) {
+            return ex->finish(ec);
+        }
+        ex->frames->commit(n);
+        read_frame(ex);
+    });
 }
 
-
-void close_connection(tcp::socket& socket) {
-    socket.close();  // close the connection after use
-    cout << "Connection closed." << endl;
+void async_exchange(tcp::socket& socket, const tcp::resolver::results_type& endpoints,
+    vector<uint8_t> packet, ResponseHandler handler, ExchangeContext context) {
+    auto ex = make_shared<Exchange>(socket, move(packet), move(handler), move(context));
+
+    ex->deadline.expires_after(chrono::seconds(EXCHANGE_TIMEOUT_SECONDS));
+    ex->deadline.async_wait([ex](const boost::system::error_code& ec) {
+        if (!ec && !ex->done) {
+            boost::system::error_code ignored;
+            ex->socket.close(ignored);  // pending operations complete with operation_aborted
+        }
+    });
+
+    // the server answers one request per connection, so every exchange connects again
+    boost::asio::async_connect(socket, endpoints, [ex](const boost::system::error_code& ec, const tcp::endpoint&) {
+        if (ec) {
+            return ex->finish(ec);
+        }
+        ex->frames->clear();  // nothing of an earlier connection is valid
+
+        if (ex->context.outbox) {
+            // the queue's writer runs on the same strand, the response can only come after the request
+            if (!ex->context.outbox->try_enqueue(move(ex->packet))) {
+                return ex->finish(boost::asio::error::would_block);
+            }
+            return read_frame(ex);
+        }
+        boost::asio::async_write(ex->socket, boost::asio::buffer(ex->packet), [ex](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                return ex->finish(ec);
+            }
+            read_frame(ex);
+        });
+    });
 }
@@ -8,6 +8,8 @@
 #include <string>
 #include <boost/asio.hpp>  
 #include <vector>
+#include <functional>
+#include "clientId.h"
 
 using boost::asio::ip::tcp;
 
@@ -28,6 +30,15 @@ struct RegistrationPayload {
     std::string public_key;   // Public key (up to 160 characters)
 };
 
+//code 603 - message types
+enum MessageType : uint8_t {
+    MSG_SYMMETRIC_KEY_REQUEST = 1,  // no content
+    MSG_SYMMETRIC_KEY = 2,          // symmetric key wrapped with the recipient's public key
+    MSG_TEXT = 3,                   // text (AES-CBC when encrypted)
+    MSG_AEAD_TEXT = 5,              // text encrypted by AEADWrapper, content starts with the suite tag
+    MSG_ENVELOPE = 6                // one text for several recipients, see create_envelope
+};
+
 //code 603 - send message 
 struct MessagePayload {
     uint8_t recipient_id[16];  // recipient 
@@ -50,6 +61,14 @@ struct Response {
     std::vector<uint8_t> payload;
 };
 
+//code 2104 - one waiting message
+struct PulledMessage {
+    ClientId sender_id;
+    uint32_t message_id;
+    uint8_t message_type;
+    std::string message_content;
+};
+
 
 std::vector<uint8_t> header_to_binary(const Header& header);
 
@@ -59,23 +78,86 @@ std::vector<uint8_t> message_payload_to_binary(const MessagePayload& payload);
 
 std::vector<uint8_t> create_registration_packet(const std::string& username, const std::string& public_key);
 
-std::vector<uint8_t> create_message_packet(const std::string& sender_id, const std::string& recipient, const std::string& message, uint8_t m_type);
+std::vector<uint8_t> create_message_packet(const ClientId& sender_id, const ClientId& recipient, const std::string& message, uint8_t m_type);
+
+std::vector<uint8_t> create_pull_messages_packet(const ClientId& client_id);
+
+std::vector<uint8_t> create_get_users_packet(const ClientId& id);
 
-std::vector<uint8_t> create_pull_messages_packet(const std::string& client_id);
+std::vector<uint8_t> create_get_public_key_packet(const ClientId& sender_id, const ClientId& recipient_id);
 
-std::vector<uint8_t> create_get_users_packet(const std::string& id);
+typedef std::function<void(PulledMessage&&)> PulledMessageHandler;
 
-std::vector<uint8_t> create_get_public_key_packet(const std::string& sender_id, const std::string& recipient_id);
+// incremental 2104 parser: the payload can arrive in pieces of any size, every record is handed
+// to the handler as soon as its last byte is fed. holds at most one record, a record with more
+// than max_message_size content bytes throws std::length_error.
+class PullMessageParser {
+public:
+    static const size_t RECORD_HEADER_SIZE = 16 + 4 + 1 + 4;
+
+    explicit PullMessageParser(size_t max_message_size);
+
+    void feed(const uint8_t* data, size_t size, const PulledMessageHandler& handler);
+
+    // true when no record is partly read
+    bool idle() const { return _header_bytes == 0; }
+
+private:
+    size_t _max_message_size;
+    uint8_t _header[RECORD_HEADER_SIZE];
+    size_t _header_bytes;
+    size_t _content_size;
+    PulledMessage _current;
+};
 
-Response read_response(tcp::socket& socket);
+std::vector<PulledMessage> parse_pull_messages_payload(const std::vector<uint8_t>& payload);
 
-void connect_to_server(tcp::socket& socket, const std::string& server_ip, int server_port);
+// 2101 record: user id (16) | username (255, null padded)
+const size_t USER_RECORD_SIZE = 16 + 255;
+typedef std::function<void(const uint8_t* record)> UserRecordHandler;
 
-void send_data(tcp::socket& socket, const std::vector<uint8_t>& data);
+// incremental 2101 parser: records are fixed size, a record cut between reads is copied once,
+// the others are handed out straight from the fed bytes
+class UserListParser {
+public:
+    UserListParser() : _record(), _buffered(0) {}
 
-//std::string receive_data(tcp::socket& socket);
+    void feed(const uint8_t* data, size_t size, const UserRecordHandler& handler);
+
+    // true when no record is partly read
+    bool idle() const { return _buffered == 0; }
+
+private:
+    uint8_t _record[USER_RECORD_SIZE];
+    size_t _buffered;
+};
+
+class FrameDecoder;
+
+// 7 raw header bytes (network order) to a ResponseHeader
+ResponseHeader parse_response_header(const uint8_t* data);
+
+// async connect + send + read of one response. handlers run on the socket's executor,
+// so a socket created on a strand keeps the whole exchange on that strand.
+// an exchange that takes longer than EXCHANGE_TIMEOUT_SECONDS fails with operation_aborted,
+// a response over the frame size limit with message_size. streamed payloads (on_message,
+// on_user) are not held as one frame, only each of their records has to fit the limit.
+const int EXCHANGE_TIMEOUT_SECONDS = 30;
+
+typedef std::function<void(const boost::system::error_code&, Response)> ResponseHandler;
+
+class SendQueue;
+
+// optional parts of an exchange, owned by the caller (usually its ClientSession)
+struct ExchangeContext {
+    SendQueue* outbox = nullptr;       // write through this queue instead of a direct async_write
+    FrameDecoder* frames = nullptr;    // read through this decoder (and its size limit) instead of a fresh one
+    PulledMessageHandler on_message;   // stream 2104 records to this handler instead of buffering the payload
+    UserRecordHandler on_user;         // stream 2101 records to this handler instead of buffering the payload
+};
 
-void close_connection(tcp::socket& socket);
+void async_exchange(tcp::socket& socket, const tcp::resolver::results_type& endpoints,
+    std::vector<uint8_t> packet, ResponseHandler handler, ExchangeContext context = ExchangeContext());
 
 #endif  // NETWORK_H
 
@@ -0,0 +1,99 @@
+// per session outgoing queue with coalesced (gathered) writes
+
+#include "sendQueue.h"
+
+using namespace std;
+
+
+SendQueue::SendQueue(tcp::socket& socket, size_t high_watermark, size_t low_watermark)
+    : _socket(socket), _high(high_watermark), _low(min(low_watermark, high_watermark)),
+    _bytes(0), _writing(false), _blocked(false) {}
+
+void SendQueue::enqueue(vector<uint8_t> packet) {
+    unique_lock<mutex> lock(_lock);
+    _drained.wait(lock, [this]() { return !_blocked; });
+    push(move(packet), lock);
+}
+
+bool SendQueue::try_enqueue(vector<uint8_t> packet) {
+    unique_lock<mutex> lock(_lock);
+    if (_blocked) {
+        return false;
+    }
+    push(move(packet), lock);
+    return true;
+}
+
+void SendQueue::flush() {
+    unique_lock<mutex> lock(_lock);
+    _drained.wait(lock, [this]() { return !_writing; });
+}
+
+size_t SendQueue::pending_bytes() const {
+    lock_guard<mutex> lock(_lock);
+    return _bytes;
+}
+
+boost::system::error_code SendQueue::last_error() const {
+    lock_guard<mutex> lock(_lock);
+    return _error;
+}
+
+void SendQueue::push(vector<uint8_t> packet, unique_lock<mutex>& lock) {
+    _bytes += packet.size();
+    _pending.push_back(move(packet));
+    if (_bytes > _high) {
+        _blocked = true;
+    }
+    if (_writing) {
+        return;  // the running write picks it up when it completes
+    }
+    _writing = true;
+    lock.unlock();
+    boost::asio::post(_socket.get_executor(), [this]() { write_pending(); });
+}
+
+// runs on the socket's executor, only one write is in flight at a time
+void SendQueue::write_pending() {
+    {
+        lock_guard<mutex> lock(_lock);
+        _inflight.swap(_pending);
+    }
+    vector<boost::asio::const_buffer> buffers;
+    buffers.reserve(_inflight.size());
+    for (const vector<uint8_t>& packet : _inflight) {
+        buffers.push_back(boost::asio::buffer(packet));
+    }
+    boost::asio::async_write(_socket, buffers, [this](const boost::system::error_code& ec, size_t written) {
+        on_written(ec, written);
+    });
+}
+
+void SendQueue::on_written(const boost::system::error_code& ec, size_t written) {
+    unique_lock<mutex> lock(_lock);
+    _inflight.clear();
+    _error = ec;
+    if (ec) {
+        // the connection is gone, what is left can't be sent either
+        _pending.clear();
+        _bytes = 0;
+    }
+    else {
+        _bytes -= written;
+    }
+    if (_blocked && _bytes <= _low) {
+        _blocked = false;
+    }
+    if (_pending.empty()) {
+        _writing = false;
+        lock.unlock();
+        _drained.notify_all();
+        return;
+    }
+    bool unblocked = !_blocked;
+    lock.unlock();
+    if (unblocked) {
+        _drained.notify_all();
+    }
+    write_pending();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <boost/asio.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using boost::asio::ip::tcp;
+
+// outgoing packets of one session.
+// any thread can enqueue; one writer on the socket's executor (the session strand) takes
+// everything pending and sends it with a single gathered async_write, so a burst of small
+// packets costs one writev instead of one write per packet.
+// backpressure: once more than high_watermark bytes are queued, enqueue blocks until the
+// writer has brought the queue under low_watermark. never enqueue from the socket's own
+// executor while the queue can be full, the writer could not run.
+class SendQueue {
+public:
+    static const size_t DEFAULT_HIGH_WATERMARK = 1024 * 1024;
+    static const size_t DEFAULT_LOW_WATERMARK = 256 * 1024;
+
+    explicit SendQueue(tcp::socket& socket,
+        size_t high_watermark = DEFAULT_HIGH_WATERMARK, size_t low_watermark = DEFAULT_LOW_WATERMARK);
+
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+
+    // queues the packet, blocks while the queue is over the high watermark
+    void enqueue(std::vector<uint8_t> packet);
+
+    // queues the packet unless the queue is over the high watermark
+    bool try_enqueue(std::vector<uint8_t> packet);
+
+    // blocks until everything queued so far is written (or failed)
+    void flush();
+
+    size_t pending_bytes() const;
+
+    // result of the last write. when it failed, the packets queued at that time were dropped
+    boost::system::error_code last_error() const;
+
+private:
+    tcp::socket& _socket;
+    size_t _high;
+    size_t _low;
+
+    mutable std::mutex _lock;
+    std::condition_variable _drained;
+    std::vector<std::vector<uint8_t>> _pending;
+    std::vector<std::vector<uint8_t>> _inflight;  // owned by the writer while a write runs
+    size_t _bytes;       // pending + in flight
+    bool _writing;
+    bool _blocked;       // went over the high watermark, producers wait for the low one
+    boost::system::error_code _error;
+
+    void push(std::vector<uint8_t> packet, std::unique_lock<std::mutex>& lock);
+    void write_pending();
+    void on_written(const boost::system::error_code& ec, size_t written);
+};
+
+#endif // SEND_QUEUE_H
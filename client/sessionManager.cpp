@@ -0,0 +1,109 @@
+// session manager: many client sessions sharded over per-core io_contexts
+
+#include "sessionManager.h"
+#include <algorithm>
+#include <iostream>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+using namespace std;
+
+
+// keeps a shard thread on one core so its sessions stay hot in that core's cache
+static void pin_to_core(thread& t, size_t core) {
+#if defined(_WIN32)
+    SetThreadAffinityMask(t.native_handle(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+    (void)t;
+    (void)core;
+#endif
+}
+
+SessionManager::SessionManager(size_t shards) : _next(0) {
+    size_t cores = max<size_t>(1, thread::hardware_concurrency());
+    if (shards == 0) {
+        shards = cores;
+    }
+    for (size_t i = 0; i < shards; i++) {
+        // concurrency hint 1: each io_context is run by a single thread. the hint only tunes asio's
+        // scheduling; its locking stays on (other threads post to these contexts), only
+        // BOOST_ASIO_CONCURRENCY_HINT_UNSAFE would turn it off
+        _contexts.push_back(make_unique<boost::asio::io_context>(1));
+        _guards.push_back(boost::asio::make_work_guard(*_contexts[i]));
+    }
+    for (size_t i = 0; i < shards; i++) {
+        _threads.emplace_back([this, i]() { _contexts[i]->run(); });
+        pin_to_core(_threads.back(), i % cores);
+    }
+}
+
+SessionManager::~SessionManager() {
+    stop();
+    lock_guard<mutex> lock(_sessions_lock);
+    _sessions.clear();  // sockets go before their io_contexts
+}
+
+void SessionManager::set_server(const string& server_ip, int server_port) {
+    tcp::resolver resolver(*_contexts[0]);
+    _endpoints = resolver.resolve(server_ip, to_string(server_port));
+}
+
+shared_ptr<ClientSession> SessionManager::create_session() {
+    size_t shard = _next++ % _contexts.size();
+    auto session = make_shared<ClientSession>(*_contexts[shard]);
+    lock_guard<mutex> lock(_sessions_lock);
+    _sessions.push_back(session);
+    return session;
+}
+
+void SessionManager::close_session(const shared_ptr<ClientSession>& session) {
+    post(session, [](ClientSession& s) {
+        boost::system::error_code ec;
+        s.socket.close(ec);
+    });
+    lock_guard<mutex> lock(_sessions_lock);
+    auto it = find(_sessions.begin(), _sessions.end(), session);
+    if (it != _sessions.end()) {
+        swap(*it, _sessions.back());
+        _sessions.pop_back();
+    }
+}
+
+size_t SessionManager::shard_count() const {
+    return _contexts.size();
+}
+
+size_t SessionManager::session_count() const {
+    lock_guard<mutex> lock(_sessions_lock);
+    return _sessions.size();
+}
+
+void SessionManager::async_request(const shared_ptr<ClientSession>& session, vector<uint8_t> packet, ResponseHandler handler) {
+    post(session, [this, session, packet = move(packet), handler = move(handler)](ClientSession& s) mutable {
+        // the session is captured so it stays alive until the exchange is done
+        async_exchange(s.socket, _endpoints, move(packet),
+            [session, handler = move(handler)](const boost::system::error_code& ec, Response resp) {
+                handler(ec, move(resp));
+            });
+    });
+}
+
+void SessionManager::stop() {
+    for (auto& guard : _guards) {
+        guard.reset();
+    }
+    for (auto& context : _contexts) {
+        context->stop();
+    }
+    for (auto& t : _threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef SESSION_MANAGER_H
+#define SESSION_MANAGER_H
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "clientSession.h"
+#include "network.h"
+
+// hosts many ClientSessions in one process.
+// sessions are sharded over N io_contexts, one thread per io_context pinned to a core.
+// every session lives on one shard and owns a strand, so its handlers run one at a time
+// while different sessions on the same shard interleave.
+// sessions must not outlive the manager that created them.
+class SessionManager {
+public:
+    // shards = 0: one shard per core
+    explicit SessionManager(size_t shards = 0);
+    ~SessionManager();
+
+    SessionManager(const SessionManager&) = delete;
+    SessionManager& operator=(const SessionManager&) = delete;
+
+    // resolves the server once, async_request reuses the endpoints for every session
+    void set_server(const std::string& server_ip, int server_port);
+    const tcp::resolver::results_type& endpoints() const { return _endpoints; }
+
+    // new session on the next shard (round robin)
+    std::shared_ptr<ClientSession> create_session();
+    void close_session(const std::shared_ptr<ClientSession>& session);
+
+    size_t shard_count() const;
+    size_t session_count() const;
+
+    // runs fn(session) on the session's strand
+    template <class F>
+    void post(const std::shared_ptr<ClientSession>& session, F fn);
+
+    // sends packet and reads one response without blocking a shard thread.
+    // handler runs on the session's strand.
+    void async_request(const std::shared_ptr<ClientSession>& session, std::vector<uint8_t> packet, ResponseHandler handler);
+
+    // stops all shards and joins their threads, pending handlers are dropped
+    void stop();
+
+private:
+    typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> WorkGuard;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> _contexts;
+    std::vector<WorkGuard> _guards;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _next;
+    tcp::resolver::results_type _endpoints;
+
+    mutable std::mutex _sessions_lock;
+    std::vector<std::shared_ptr<ClientSession>> _sessions;
+};
+
+template <class F>
+void SessionManager::post(const std::shared_ptr<ClientSession>& session, F fn) {
+    boost::asio::post(session->strand, [session, fn = std::move(fn)]() mutable { fn(*session); });
+}
+
+#endif // SESSION_MANAGER_H
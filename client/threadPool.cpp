@@ -0,0 +1,98 @@
+// work stealing thread pool used for parallel crypto work (key wraps, batch decryption)
+
+#include "threadPool.h"
+#include <algorithm>
+
+using namespace std;
+
+// index of the pool worker running on this thread, -1 on other threads
+static thread_local long worker_index = -1;
+static thread_local const ThreadPool* worker_pool = nullptr;
+
+
+ThreadPool::ThreadPool(size_t threads) : _next(0), _pending(0), _stop(false) {
+    threads = max<size_t>(1, threads);
+    for (size_t i = 0; i < threads; i++) {
+        _queues.push_back(make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        _threads.emplace_back([this, i]() { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(_wake_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& t : _threads) {
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+size_t ThreadPool::size() const {
+    return _threads.size();
+}
+
+void ThreadPool::push(function<void()> task) {
+    // a worker keeps what it submits (hot in its cache), others spread the work round robin
+    size_t index = (worker_pool == this) ? static_cast<size_t>(worker_index) : _next++ % _queues.size();
+    {
+        lock_guard<mutex> lock(_queues[index]->lock);
+        _queues[index]->tasks.push_back(move(task));
+    }
+    {
+        lock_guard<mutex> lock(_wake_lock);
+        _pending++;
+    }
+    _wake.notify_one();
+}
+
+bool ThreadPool::pop(size_t index, function<void()>& task) {
+    // own queue first (newest task), then steal the oldest task of another worker
+    {
+        WorkerQueue& own = *_queues[index];
+        lock_guard<mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < _queues.size(); i++) {
+        WorkerQueue& victim = *_queues[(index + i) % _queues.size()];
+        lock_guard<mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t index) {
+    worker_index = static_cast<long>(index);
+    worker_pool = this;
+
+    while (true) {
+        function<void()> task;
+        if (pop(index, task)) {
+            _pending--;
+            task();
+            continue;
+        }
+
+        unique_lock<mutex> lock(_wake_lock);
+        if (_stop && _pending <= 0) {
+            return;
+        }
+        _wake.wait(lock, [this]() { return _stop || _pending > 0; });
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// work stealing thread pool for cpu bound crypto work.
+// every worker owns a deque: it takes its own tasks from the back and, when it runs dry,
+// steals from the front of the other workers. tasks submitted from outside the pool are
+// spread round robin, tasks submitted by a worker stay on that worker.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // one pool for the whole process, sized to the number of cores
+    static ThreadPool& shared();
+
+    size_t size() const;
+
+    // runs f on the pool, the future holds its result or exception
+    template <class F>
+    std::future<typename std::invoke_result<F>::type> submit(F f);
+
+private:
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> _queues;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _next;
+    std::atomic<long> _pending;
+    bool _stop;
+    std::mutex _wake_lock;
+    std::condition_variable _wake;
+
+    void push(std::function<void()> task);
+    bool pop(size_t index, std::function<void()>& task);
+    void run(size_t index);
+};
+
+template <class F>
+std::future<typename std::invoke_result<F>::type> ThreadPool::submit(F f) {
+    typedef typename std::invoke_result<F>::type result_type;
+    auto task = std::make_shared<std::packaged_task<result_type()>>(std::move(f));
+    std::future<result_type> result = task->get_future();
+    push([task]() { (*task)(); });
+    return result;
+}
+
+#endif // THREAD_POOL_H
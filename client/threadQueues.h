@@ -0,0 +1,85 @@
+#pragma once
+#ifndef THREAD_QUEUES_H
+#define THREAD_QUEUES_H
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// bounded lock-free queues between the client's threads:
+//   input thread   --CommandQueue (spsc)-->  network thread
+//   any thread     --RenderQueue (mpsc)--->  render thread
+// each direction has a Wakeup, so a thread with nothing to do sleeps instead of polling
+
+// one menu choice with everything the user typed for it, so the network thread never reads stdin
+struct UserCommand {
+    int option = -1;
+    std::string target;   // username (110), recipient (130, 15x) or comma separated recipients (160)
+    std::string text;     // message text (150, 160)
+};
+
+// one piece of console output
+struct RenderItem {
+    enum Kind { LINE, ERROR_LINE, PROMPT };
+    Kind kind;
+    std::string text;
+};
+
+const size_t COMMAND_QUEUE_SIZE = 64;
+const size_t RENDER_QUEUE_SIZE = 1024;
+
+typedef boost::lockfree::spsc_queue<UserCommand, boost::lockfree::capacity<COMMAND_QUEUE_SIZE>> CommandQueue;
+
+// lockfree::queue needs a trivial type, so items travel as pointers owned by the consumer
+typedef boost::lockfree::queue<RenderItem*, boost::lockfree::capacity<RENDER_QUEUE_SIZE>> RenderQueue;
+
+// a thread that found its queue empty (or full) sleeps here until the other side changes the queue
+// and calls notify(). notify() only takes the lock when somebody sleeps, so a push stays lock-free
+class Wakeup {
+public:
+    Wakeup() : _sleepers(0) {}
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // the queue change is seen by a sleeper's last attempt
+        if (_sleepers.load(std::memory_order_relaxed) != 0) {
+            std::lock_guard<std::mutex> lock(_lock);
+            _cond.notify_all();
+        }
+    }
+
+    // sleeps until attempt() succeeds, it is tried again after every notify()
+    template <class Attempt>
+    void wait(Attempt& attempt) {
+        std::unique_lock<std::mutex> lock(_lock);
+        _sleepers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _cond.wait(lock, [&attempt]() { return attempt(); });
+        _sleepers.fetch_sub(1);
+    }
+
+private:
+    std::atomic<unsigned> _sleepers;
+    std::mutex _lock;
+    std::condition_variable _cond;
+};
+
+// waiting on an empty (or full) queue: attempt() is the pop (or push). spin a little, then yield,
+// then sleep on wakeup. returns once attempt() succeeded
+template <class Attempt>
+void wait_until(Wakeup& wakeup, Attempt attempt) {
+    for (unsigned rounds = 0; !attempt(); rounds++) {
+        if (rounds >= 128) {
+            wakeup.wait(attempt);
+            return;
+        }
+        if (rounds >= 64) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+#endif // THREAD_QUEUES_H
@@ -1,32 +1,45 @@
-// helper functions
+// helper functions for my.info. they report nothing themselves, callers show their own errors
 
 #include "utils.h"
-#include <iostream>
 #include <string>
 #include <fstream>
-#include "client_ui.h" 
 #include <filesystem>
 
+using namespace std;
+
+// my.info holds one record of 3 lines per registered user: username, id (hex), private key
+static bool read_user_record(ifstream& file, string& username, ClientId& user_id, string& private_key) {
+    string id_line;
+    while (getline(file, username) && getline(file, id_line) && getline(file, private_key)) {
+        try {
+            user_id = ClientId::from_hex(id_line);
+            return true;
+        }
+        catch (const exception&) {
+            // damaged record, skip it
+        }
+    }
+    return false;
+}
 
 // get id from my.info
-string get_id_by_username(const string& username) {
+ClientId get_id_by_username(const string& username) {
 
     ifstream file("my.info");
 
     if (!file.is_open()) {
-        display_err("Error: Could not open my.info for reading");
-        return "";
+        return ClientId();
     }
 
-    string file_username, file_userid, public_key;
-    while (getline(file, file_username) && getline(file, file_userid) && getline(file, public_key)) {
+    string file_username, public_key;
+    ClientId file_userid;
+    while (read_user_record(file, file_username, file_userid, public_key)) {
         if (file_username == username) {
             return file_userid;
         }
     }
 
-    display_err("Username not found in my.info");
-    return "";
+    return ClientId();  // empty: not found
 }
 
 //check if user name is in my.info
@@ -36,8 +49,9 @@ bool user_in_file(const string& username) {
         return false;  
     }
 
-    string file_username, file_userid;
-    while (getline(file, file_username) && getline(file, file_userid)) {
+    string file_username, private_key;
+    ClientId file_userid;
+    while (read_user_record(file, file_username, file_userid, private_key)) {
         if (file_username == username) {
             return true;  
         }
@@ -46,19 +60,51 @@ bool user_in_file(const string& username) {
     return false;  
 }
 
-string get_username_by_id(const string& user_id) {
+// get id and private key of a registered user from my.info
+bool load_user_from_file(const string& username, ClientId& user_id, string& private_key) {
+    ifstream file("my.info");
+    if (!file.is_open()) {
+        return false;
+    }
+
+    string file_username, file_key;
+    ClientId file_userid;
+    while (read_user_record(file, file_username, file_userid, file_key)) {
+        if (file_username == username) {
+            user_id = file_userid;
+            private_key = file_key;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+string get_username_by_id(const ClientId& user_id) {
     ifstream file("my.info");
     if (!file.is_open()) {
-        display_err("Error: Could not open my.info for reading");
-        return user_id;  // fallback: return the ID
+        return user_id.to_hex();  // fallback: return the ID
     }
 
-    string file_username, file_userid;
-    while (std::getline(file, file_username) && getline(file, file_userid)) {
+    string file_username, private_key;
+    ClientId file_userid;
+    while (read_user_record(file, file_username, file_userid, private_key)) {
         if (file_userid == user_id) {
             return file_username;
         }
     }
 
-    return user_id;  // fallback if not found
-}
\ No newline at end of file
+    return user_id.to_hex();  // fallback if not found
+}
+
+// appends the record of a newly registered user to my.info
+bool save_user_to_file(const string& username, const ClientId& user_id, const string& private_key) {
+    ofstream file("my.info", ios::app);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << username << "\n";
+    file << user_id.to_hex() << "\n";
+    file << private_key << "\n";
+    return true;
+}
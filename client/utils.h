@@ -2,9 +2,14 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include "clientId.h"
 
-std::string get_id_by_username(const std::string& username);
+ClientId get_id_by_username(const std::string& username);
 
-std::string get_username_by_id(const std::string& user_id);
+std::string get_username_by_id(const ClientId& user_id);
 
 bool user_in_file(const std::string& username);
+
+bool load_user_from_file(const std::string& username, ClientId& user_id, std::string& private_key);
+
+bool save_user_to_file(const std::string& username, const ClientId& user_id, const std::string& private_key);
@@ -1,14 +1,77 @@
 # open file with connection info
 
+from serverLog import get_logger
+
+log = get_logger("config")
+
 def get_port(file_path):
     try:
         with open(file_path, 'r') as file:
-            port = file.read().strip()
+            port = file.readline().strip()
             port = int(port)
 
             return port
     except (FileNotFoundError, ValueError) as e:
-        print(f"Error: {e}. Returning default port 1234.\n")
+        log.warning("%s. Returning default port 1234.", e)
         return 1234
 
 
+# optional "<name>:<integer>" lines after the port
+def get_option(file_path, name, default):
+    try:
+        with open(file_path, 'r') as file:
+            for line in file.read().splitlines()[1:]:
+                key, _, value = line.partition(':')
+                if key.strip() == name:
+                    return int(value)
+    except (FileNotFoundError, ValueError) as e:
+        log.warning("%s. Using default %s %s.", e, name, default)
+    return default
+
+
+# biggest request payload accepted
+def get_max_payload_size(file_path, default=16 * 1024 * 1024):
+    return get_option(file_path, 'max_payload_size', default)
+
+
+# length of the accept queue, connections beyond it are refused by the os
+def get_backlog(file_path, default=1024):
+    return get_option(file_path, 'backlog', default)
+
+
+# threads for heavy handlers, 0 runs every handler on the event loop
+def get_workers(file_path, default=0):
+    return get_option(file_path, 'workers', default)
+
+
+
+
+# 1 keeps waiting messages in the message log on disk, 0 in memory only
+def get_message_log(file_path, default=1):
+    return get_option(file_path, 'message_log', default) != 0
+
+
+# 1 keeps registered users in the sqlite database, 0 in memory only
+def get_user_database(file_path, default=1):
+    return get_option(file_path, 'user_database', default) != 0
+
+
+# lowest log level written: 10 debug (every request), 20 info (default), 30 warnings, 40 errors
+def get_log_level(file_path, default=20):
+    return get_option(file_path, 'log_level', default)
+
+
+# "log_sample_<category>:<n>" lines: keep 1 of n records below warning of that category
+def get_log_samples(file_path):
+    samples = {}
+    try:
+        with open(file_path, 'r') as file:
+            for line in file.read().splitlines()[1:]:
+                key, _, value = line.partition(':')
+                key = key.strip()
+                if key.startswith('log_sample_'):
+                    samples[key[len('log_sample_'):]] = max(1, int(value))
+    except (FileNotFoundError, ValueError) as e:
+        log.warning("%s. Log sampling is off.", e)
+        return {}
+    return samples
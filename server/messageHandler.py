@@ -2,8 +2,14 @@
 # handle clients messages in the high level
 # works in parallel with protocolUtils that works on network layer
 
+import logging
+import threading
+from concurrent.futures import Future
 from protocolUtils import *
 from message_storage import *
+from serverLog import get_logger
+
+log = get_logger("request")
 
 
 '''
@@ -13,21 +19,75 @@ processes
 '''
 
 
-# function for request 601 to get users list
-def get_users(user_storage, user_id):
+# function for request 603 with message type 6 (one message for several recipients)
+def process_envelope(user_id, envelope, conn, user_storage):
+    """
+    stores one message per recipient: the recipient's own wrapped key followed by the shared body.
+    the body is copied out of the request once and every copy keeps a reference to it.
+    nothing is stored if a recipient is unknown.
+    """
+    try:
+        recipients, body = split_envelope(envelope)
+    except ValueError as e:
+        log.warning("Error processing envelope: %s", e)
+        send_response(conn, build_response(1, 9000))
+        return
+
+    for recipient_id, _ in recipients:
+        if not user_storage.get_user_by_id(recipient_id):
+            log.warning("Recipient ID %s not found.", recipient_id.hex())
+            send_response(conn, build_response(1, 9000))
+            return
+
+    first_message_id = None
+    commits = []
+    body = bytes(body)
+    try:
+        for recipient_id, wrapped_key in recipients:
+            key = len(wrapped_key).to_bytes(2, byteorder='big') + wrapped_key
+            message_id, commit = store_message(user_id, recipient_id, MESSAGE_TYPE_ENVELOPE, key, body)
+            if first_message_id is None:
+                first_message_id = message_id
+            if commit is not None:
+                commits.append(commit)
+    except Exception as e:
+        log.error("Error saving message to storage: %s", e)
+        send_response(conn, build_response(1, 9000))
+        return
+
+    # the copies can be written by different group commits, every one of them has to succeed
+    hold_response(conn, all_committed(commits))
+    # the ack names the first recipient and the ID its copy got
+    send_response(conn, build_response(1, 2103, (recipients[0][0], first_message_id)))
+
+
+def all_committed(commits):
     """
-    retrieves all users from user_storage, excluding the requester
+    one future for several commits: done once all of them are, failed if any of them failed.
+    None when there is nothing to wait for.
     """
-    all_users = user_storage.load_user_data()  # user list contain user dict info
-    users_list = []
-    for user in all_users:
-        print(user)
-        if user.get("user_id") != user_id:
-            users_list.append({
-                "user_id": user.get("user_id", ""),
-                "username": user.get("username", "")
-            })
-    return users_list
+    if not commits:
+        return None
+    if len(commits) == 1:
+        return commits[0]
+    combined = Future()
+    lock = threading.Lock()
+    left = [len(commits)]
+
+    def done(commit):
+        with lock:
+            left[0] -= 1
+            if combined.done():
+                return
+            error = commit.exception()
+            if error is not None:
+                combined.set_exception(error)
+            elif left[0] == 0:
+                combined.set_result(None)
+
+    for commit in commits:
+        commit.add_done_callback(done)
+    return combined
 
 
 '''
@@ -68,40 +128,49 @@ def send_response(conn, response_packet):
     sends the complete response packet to the client over the connection.
 
     parameters:
-      - conn: a socket object (e.g., from the socket module) already connected to the client.
+      - conn: the connection's response buffer (server.py), written to the client once the request is done.
       - response_packet: a bytes object that represents the full response (header + payload).
     """
     try:
-        header_info = struct.unpack("!B H I", response_packet[:7])
-        print(f"[DEBUG] Server sending header: version={header_info[0]}, code={header_info[1]}, payload_size={header_info[2]}")
+        if log.isEnabledFor(logging.DEBUG):
+            version, code, payload_size = struct.unpack("!B H I", response_packet[:7])
+            log.debug("Server sending header: version=%d, code=%d, payload_size=%d", version, code, payload_size)
         conn.sendall(response_packet)
-        print("Response successfully sent to client.")
     except Exception as e:
-        print("Error sending response:", e)
+        log.error("Error sending response: %s", e)
 
 
-# receiving messages from client
-def handle_client(conn, user_storage, user_manager):
+def hold_response(conn, commit):
+    """
+    the response may only reach the client once commit (a message log / user database write) is on disk.
+    conn (server.py's response buffer) holds what it collected until then.
+    """
+    if commit is not None:
+        conn.hold_until(commit)
+
+
+def send_response_parts(conn, version, code, parts):
+    """
+    sends a response whose payload is already encoded in pieces (slices of the cached users
+    directory, stored message records). the pieces are written as they are, they are never joined.
+    """
+    header = create_response_header(version, code, sum(len(part) for part in parts))
+    send_response(conn, header)
     try:
-        # receive data from the client
-        data = conn.recv(1024)
-        # if no data is received, return
-        if not data:
-            print("no data received \n")
-            return
+        for part in parts:
+            if len(part):
+                conn.sendall(part)
+    except Exception as e:
+        log.error("Error sending response: %s", e)
 
-        header, payload = decode_packet(data)
-        if header is None:
-            print("Error decoding packet.")
-            return
 
-        print("Decoded Header:", header)
+# runs one decoded request, the response goes to conn.sendall
+def handle_request(header, payload, conn, user_storage, user_manager):
+    try:
+        log.debug("Decoded Header: %s", header)
         process_request(header, payload, conn, user_storage, user_manager)
     except Exception as e:
-        print(f"Error handling client: {e} \n")
-
-    finally:
-        conn.close()
+        log.exception("Error handling client: %s", e)
 
 
 def process_request(header, payload, conn, user_storage, user_manager):
@@ -113,77 +182,74 @@ def process_request(header, payload, conn, user_storage, user_manager):
         success, response_data = process_registration(payload, user_storage, user_manager)
         if success:
             # Registration success; use code 2100 and data is client_id.
+            # the client keeps the id in my.info, it goes out once the user is persisted
+            hold_response(conn, user_storage.pending_commit())
             response_packet = build_response(1, 2100, response_data)  # response_data = get user id
-            print("size of data sent: " + str(len(response_packet)))
+            log.debug("size of data sent: %d", len(response_packet))
             send_response(conn, response_packet)
     elif request_code == 601:  # get users list
-        user_id = header.get("client_id", "").strip()
-        user_id = bytes.fromhex(user_id).decode('ascii')
-        print('server getting user id for user: ' + user_id)
-        response_data = get_users(user_storage, user_id)  # user list
-        response_packet = build_response(1, 2101, response_data)  # build header and payload to binary, generate packet
-        print("size of data sent: " + str(len(response_packet)))
-        send_response(conn, response_packet)
+        user_id = header.get("client_id")
+        log.debug("users list for user: %s", user_id.hex())
+        # pre-encoded directory, the requester's own record is sliced out
+        send_response_parts(conn, 1, 2101, user_storage.directory_payload(user_id))
     elif request_code == 602:  # request for public key
-        recipient_id_bytes = payload[:16]
-        recipient_id = recipient_id_bytes.decode('ascii').rstrip('\0')
+        recipient_id = bytes(payload[:16])
 
         user = user_storage.get_user_by_id(recipient_id)
         if user:
             public_key = user.get("public_key", "")
-            print(f"Sending public key of {recipient_id}: {public_key}")
+            log.debug("Sending public key of %s", recipient_id.hex())
             response_packet = build_response(1, 2102, (recipient_id, public_key))
             send_response(conn, response_packet)
         else:
-            print(f"Public key request failed. User ID {recipient_id} not found.")
+            log.warning("Public key request failed. User ID %s not found.", recipient_id.hex())
             response_packet = build_response(1, 9000, b"User not found")
             send_response(conn, response_packet)
     elif request_code == 603:  # send message
-        user_id = header.get("client_id", "").strip()
-        user_id = bytes.fromhex(user_id).decode('ascii')
+        user_id = header.get("client_id")
         # extract message details from the payload
         recipient_id, message_type, content_size, message_content = process_message(user_id, payload)
+        if message_type == MESSAGE_TYPE_ENVELOPE:
+            process_envelope(user_id, message_content, conn, user_storage)
+            return
         # recipient validation:
         recipient_user = user_storage.get_user_by_id(recipient_id)
         if not recipient_user:
-            print(f"Recipient ID {recipient_id} not found.")
+            log.warning("Recipient ID %s not found.", recipient_id.hex() if recipient_id else None)
             response_packet = build_response(1, 9000)
             send_response(conn, response_packet)
             return
         # verify that the recipient's username exists in storage
         if recipient_user and not user_storage.username_exists(recipient_user['username']):
-            print(f"Recipient username {recipient_user['username']} not found.")
+            log.warning("Recipient username %s not found.", recipient_user['username'])
             response_packet = build_response(1, 9000)
             send_response(conn, response_packet)
             return
 
-        # build a response packet, send it
-        # save messages to storage in message_storage.py
-        response_data = (recipient_id, message_type, content_size, message_content)
-        response_packet = build_response(1, 2103, response_data)
+        # save messages to storage in message_storage.py, the content parsed above is copied once
+        # into the stored record. build a response packet with the stored message ID, send it once
+        # the message is durable
+        try:
+            message_id, commit = store_message(user_id, recipient_id, message_type, message_content)
+        except Exception as e:
+            log.error("Error saving message to storage: %s", e)
+            send_response(conn, build_response(1, 9000))
+            return
+        hold_response(conn, commit)
+        response_packet = build_response(1, 2103, (recipient_id, message_id))
         send_response(conn, response_packet)
-        save_to_message_storage(user_id, payload)
 
     elif request_code == 604:  # get all waiting messages
-        recipient_id = header.get("client_id", "").strip()
-        recipient_id = bytes.fromhex(recipient_id).decode('ascii')
-        print(f"Received message fetch request from: {recipient_id}")
-        print("DEBUG: Current MESSAGE_STORAGE:", MESSAGE_STORAGE)  # -------------------
+        recipient_id = header.get("client_id")
+        log.debug("Received message fetch request from: %s", recipient_id.hex())
+        # taken out of storage in one step, messages stored meanwhile wait for the next fetch
         messages = get_messages_for_recipient(recipient_id)
-        print(f"DEBUG: Messages for {recipient_id}: {messages}")  # -------------------
-        if not messages:
-            print(f"No messages for {recipient_id}")
-            # Still send an empty 2104 payload
-            response_packet = build_response(1, 2104, b'')
-            send_response(conn, response_packet)
-            return
-        response_packet = build_response(1, 2104, messages)
-        send_response(conn, response_packet)
-        # clear the messages after sending
-        MESSAGE_STORAGE.pop(recipient_id, None)
+        log.debug("%d messages for %s", len(messages), recipient_id.hex())
+        # the stored 2104 records are written as they are (an empty payload when there are none)
+        send_response_parts(conn, 1, 2104, record_parts(messages))
 
     else:
-        print(f"Unknown request code: {request_code}")
+        log.warning("Unknown request code: %s", request_code)
         response_packet = build_response(1, 9000)
         send_response(conn, response_packet)
 
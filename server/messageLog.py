@@ -0,0 +1,394 @@
+# write-ahead log of waiting messages, so a restart does not lose undelivered messages.
+# every stored message is appended as a record, a fetch tombstones what it delivered.
+# the log is a directory of segment files, replayed on startup.
+
+import os
+import struct
+import threading
+import zlib
+from concurrent.futures import Future
+from serverLog import get_logger
+
+log = get_logger("message_log")
+
+
+'''
+===================================
+record format
+===================================
+every record: size (4) | crc32 of body (4) | body, sizes big-endian like the protocol.
+bodies:
+  - store:     kind 1 (1) | recipient id (16) | the message's 2104 record (its message ID at offset 16)
+  - tombstone: kind 2 (1) | recipient id (16) | message ID (4): the recipient got everything up to it
+message IDs are a sequence per recipient, so a message is waiting if its ID is above the recipient's
+last tombstone, in whatever order the records were written. replay puts messages in ID order.
+'''
+
+RECORD_HEADER = struct.Struct("!I I")
+STORE_HEADER = struct.Struct("!B 16s")
+STORE_MESSAGE_ID = struct.Struct("!16x I")  # in the 2104 record, after the sender id
+TOMBSTONE = struct.Struct("!B 16s I")
+TOMBSTONE_SIZE = RECORD_HEADER.size + TOMBSTONE.size
+KIND_STORE = 1
+KIND_TOMBSTONE = 2
+
+
+def encode_record(body):
+    return RECORD_HEADER.pack(len(body), zlib.crc32(body)) + body
+
+
+def encode_store(recipient_id, record):
+    """
+    the store record as a tuple of parts: a 2104 record kept in parts (a shared envelope body)
+    is only joined by the writer, into its batch.
+    """
+    head = STORE_HEADER.pack(KIND_STORE, recipient_id)
+    parts = record if isinstance(record, tuple) else (record,)
+    crc = zlib.crc32(head)
+    for part in parts:
+        crc = zlib.crc32(part, crc)
+    size = len(head) + sum(len(part) for part in parts)
+    return (RECORD_HEADER.pack(size, crc) + head,) + parts
+
+
+def encode_tombstone(recipient_id, message_id):
+    return encode_record(TOMBSTONE.pack(KIND_TOMBSTONE, recipient_id, message_id))
+
+
+def read_records(path):
+    """
+    yields (offset, body) for every complete record of a segment. stops at the first torn or
+    corrupt record (a crash in the middle of a write) and returns its offset as the valid length.
+    """
+    with open(path, 'rb') as file:
+        data = file.read()
+    offset = 0
+    while offset + RECORD_HEADER.size <= len(data):
+        size, crc = RECORD_HEADER.unpack_from(data, offset)
+        start = offset + RECORD_HEADER.size
+        body = data[start:start + size]
+        if len(body) < size or zlib.crc32(body) != crc:
+            break
+        yield offset, body
+        offset = start + size
+    return offset
+
+
+def decode_store(body):
+    """returns (recipient id, message ID, 2104 record)."""
+    _, recipient_id = STORE_HEADER.unpack_from(body)
+    message_id = STORE_MESSAGE_ID.unpack_from(body, STORE_HEADER.size)[0]
+    return recipient_id, message_id, body[STORE_HEADER.size:]
+
+
+def decode_tombstone(body):
+    """returns (recipient id, message ID)."""
+    _, recipient_id, message_id = TOMBSTONE.unpack(body)
+    return recipient_id, message_id
+
+
+class MessageLog:
+    """
+    appends go to a queue; one writer thread writes everything queued with a single write and
+    fsync (group commit) and then completes the futures of the stores in that batch, so many
+    concurrent sends share one disk flush. a batch that fails is cut off the segment again
+    (or, if that fails too, left behind in a segment nothing is appended to any more), so it never
+    comes back on replay and nothing lands behind a torn record.
+    segments are rolled at segment_size. a compaction thread rewrites sealed segments that are
+    mostly delivered (see COMPACT_LIVE_RATIO): their messages that are still waiting and the
+    current tombstone of every recipient they have one for are appended again, then the file is
+    deleted. so the last message ID of a recipient is
+    never forgotten, and IDs are not given out twice after a restart.
+    """
+
+    SEGMENT_SIZE = 64 * 1024 * 1024
+    # a sealed segment is compacted once less than this share of it is still waiting. with more
+    # than MAX_SEALED_SEGMENTS sealed segments that still hold delivered messages, the one with
+    # the smallest waiting share is compacted too. a segment whose messages are all waiting is
+    # never rewritten: that would only move it to the head of the log
+    COMPACT_LIVE_RATIO = 0.5
+    MAX_SEALED_SEGMENTS = 8
+    COMPACT_INTERVAL = 10.0
+
+    def __init__(self, directory, segment_size=SEGMENT_SIZE):
+        self._directory = directory
+        self._segment_size = segment_size
+        self._lock = threading.Lock()          # delivered IDs and queue order
+        self._wakeup = threading.Condition(self._lock)
+        self._queue = []                       # (encoded record, future or None)
+        self._delivered = {}                   # recipient id -> last message ID tombstoned
+        self._segments = []                    # segment numbers, the last one is written to
+        self._fd = None
+        self._size = 0
+        self._closing = False
+        self._writer = None
+        self._compactor = None
+        self._compact_wakeup = threading.Event()
+        self._scans = {}                       # sealed segment number -> (size, stores, tombstoned), compaction thread only
+
+    '''
+    ===================================
+    startup
+    ===================================
+    '''
+
+    def open(self):
+        """
+        replays the segments and starts the writer and compaction threads. returns
+          - the waiting messages: {recipient id: 2104 records in message ID order}
+          - the last message ID given out to every recipient: {recipient id: message ID}
+        """
+        os.makedirs(self._directory, exist_ok=True)
+        self._segments = sorted(int(name[len("segment-"):-len(".log")]) for name in os.listdir(self._directory)
+                                if name.startswith("segment-") and name.endswith(".log"))
+        stored = {}
+        delivered = {}
+        for number in self._segments:
+            path = self._path(number)
+            records = read_records(path)
+            while True:
+                try:
+                    _, body = next(records)
+                except StopIteration as end:
+                    valid = end.value
+                    break
+                if body[0] == KIND_STORE:
+                    recipient_id, message_id, record = decode_store(body)
+                    stored.setdefault(recipient_id, {})[message_id] = record  # a compaction copy replaces its original
+                elif body[0] == KIND_TOMBSTONE:
+                    recipient_id, message_id = decode_tombstone(body)
+                    delivered[recipient_id] = max(message_id, delivered.get(recipient_id, 0))
+            if valid < os.path.getsize(path):
+                log.warning("dropping a torn record at the end of %s", path)
+                with open(path, 'r+b') as file:
+                    file.truncate(valid)
+
+        if not self._segments:
+            self._segments.append(1)
+        self._fd = self._open_segment(self._segments[-1])
+        self._size = os.lseek(self._fd, 0, os.SEEK_END)
+
+        self._delivered = delivered
+        self._writer = threading.Thread(target=self._write_loop, name="message-log-writer", daemon=True)
+        self._writer.start()
+        self._compactor = threading.Thread(target=self._compact_loop, name="message-log-compaction", daemon=True)
+        self._compactor.start()
+
+        last_ids = dict(delivered)
+        waiting = {}
+        for recipient_id, records in stored.items():
+            last = delivered.get(recipient_id, 0)
+            last_ids[recipient_id] = max(last, max(records))
+            ids = sorted(message_id for message_id in records if message_id > last)
+            if ids:
+                waiting[recipient_id] = [records[message_id] for message_id in ids]
+        return waiting, last_ids
+
+    def close(self):
+        with self._lock:
+            self._closing = True
+            self._wakeup.notify()
+        self._compact_wakeup.set()
+        self._writer.join()
+        self._compactor.join()
+        os.close(self._fd)
+
+    '''
+    ===================================
+    appends
+    ===================================
+    '''
+
+    def append_store(self, recipient_id, record, on_commit=None):
+        """
+        logs a message (its 2104 record, bytes or a tuple of parts). returns a future that completes
+        once the record is on disk.
+        on_commit(future) is called by the writer when the write is done or failed, in log order.
+        """
+        future = Future()
+        if on_commit is not None:
+            future.add_done_callback(on_commit)
+        encoded = encode_store(recipient_id, record)
+        with self._lock:
+            self._enqueue(encoded, future)
+        return future
+
+    def append_tombstone(self, recipient_id, message_id):
+        """
+        logs that the recipient got every message up to message_id. nobody waits for it
+        (a crash before it is written delivers them again).
+        """
+        encoded = encode_tombstone(recipient_id, message_id)
+        with self._lock:
+            if message_id > self._delivered.get(recipient_id, 0):
+                self._delivered[recipient_id] = message_id
+            self._enqueue(encoded, None)
+
+    def _enqueue(self, record, future):
+        # under self._lock: the queue order is the log order. record is bytes or a tuple of parts
+        self._queue.append((record, future))
+        if len(self._queue) == 1:
+            self._wakeup.notify()
+
+    '''
+    ===================================
+    writer: group commit
+    ===================================
+    '''
+
+    def _write_loop(self):
+        while True:
+            with self._lock:
+                while not self._queue and not self._closing:
+                    self._wakeup.wait()
+                if not self._queue:
+                    return
+                batch, self._queue = self._queue, []
+
+            data = b''.join(part for record, _ in batch
+                            for part in (record if isinstance(record, tuple) else (record,)))
+            error = None
+            try:
+                self._write(data)
+                os.fsync(self._fd)
+                self._size += len(data)
+            except OSError as e:
+                log.error("write failed: %s", e)
+                error = e
+                self._discard_batch()
+            for _, future in batch:
+                if future is None:
+                    continue
+                if error is None:
+                    future.set_result(None)
+                else:
+                    future.set_exception(error)
+
+            if error is None and self._size >= self._segment_size:
+                self._roll()
+
+    def _write(self, data):
+        view = memoryview(data)
+        while view:
+            view = view[os.write(self._fd, view):]
+
+    def _discard_batch(self):
+        # writer thread only: the senders of the batch get a 9000, so none of it may be replayed
+        try:
+            os.ftruncate(self._fd, self._size)
+            os.fsync(self._fd)
+            return
+        except OSError as e:
+            log.error("could not cut the failed batch off segment %d: %s", self._segments[-1], e)
+        # a torn tail ends a segment on replay, the next records go to a new one
+        try:
+            self._roll()
+        except OSError as e:
+            log.error("could not start a new segment: %s", e)
+
+    def _roll(self):
+        # writer thread only
+        number = self._segments[-1] + 1
+        fd = self._open_segment(number)
+        os.close(self._fd)
+        self._fd = fd
+        self._size = 0
+        with self._lock:
+            self._segments.append(number)
+        self._compact_wakeup.set()
+
+    def _open_segment(self, number):
+        return os.open(self._path(number), os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+
+    '''
+    ===================================
+    compaction
+    ===================================
+    '''
+
+    def _compact_loop(self):
+        while not self._closing:
+            self._compact_wakeup.wait(self.COMPACT_INTERVAL)
+            self._compact_wakeup.clear()
+            while not self._closing and self._compact_oldest():
+                pass
+
+    def _scan(self, number):
+        """
+        sealed segments never change, so each is read once: its size, (recipient id, message ID,
+        record size) of every store and the recipients it has tombstones for.
+        """
+        scan = self._scans.get(number)
+        if scan is None:
+            stores = []
+            tombstoned = set()
+            total = 0
+            for _, body in read_records(self._path(number)):
+                size = RECORD_HEADER.size + len(body)
+                total += size
+                if body[0] == KIND_STORE:
+                    stores.append(decode_store(body)[:2] + (size,))
+                elif body[0] == KIND_TOMBSTONE:
+                    tombstoned.add(decode_tombstone(body)[0])
+            scan = self._scans[number] = (total, stores, tombstoned)
+        return scan
+
+    def _live_size(self, scan):
+        # the delivered IDs only grow, a read outside the lock at worst counts a message as waiting
+        _, stores, tombstoned = scan
+        return (sum(size for recipient_id, message_id, size in stores
+                    if message_id > self._delivered.get(recipient_id, 0))
+                + len(tombstoned) * TOMBSTONE_SIZE)
+
+    def _pick_segment(self, sealed):
+        """the sealed segment to compact next, or None when no compaction would pay off."""
+        shrinkable = []
+        for number in sealed:
+            scan = self._scan(number)
+            total = scan[0]
+            live_size = self._live_size(scan)
+            if total == 0:
+                return number  # empty (left by a failed write), removing it costs nothing
+            if live_size >= total:
+                continue  # nothing in it was delivered
+            if live_size < total * self.COMPACT_LIVE_RATIO:
+                return number
+            shrinkable.append((live_size / total, number))
+        if len(shrinkable) > self.MAX_SEALED_SEGMENTS:
+            return min(shrinkable)[1]
+        return None
+
+    def _compact_oldest(self):
+        """compacts one sealed segment, returns True if one was removed (so dead bytes were dropped)."""
+        with self._lock:
+            sealed = self._segments[:-1]
+        number = self._pick_segment(sealed)
+        if number is None:
+            return False
+        path = self._path(number)
+        total, _, tombstoned = self._scan(number)
+        stores = [decode_store(body)[:2] + (body,) for _, body in read_records(path) if body[0] == KIND_STORE]
+
+        with self._lock:
+            # the writer stops once the queue is empty after close(), nothing may be queued then
+            if self._closing:
+                return False
+            live = [body for recipient_id, message_id, body in stores
+                    if message_id > self._delivered.get(recipient_id, 0)]
+            future = Future()
+            for body in live:
+                self._enqueue(encode_record(body), None)
+            for recipient_id in tombstoned:
+                self._enqueue(encode_tombstone(recipient_id, self._delivered[recipient_id]), None)
+            self._enqueue(b'', future)  # completes once the copies are on disk
+
+        future.result()
+        os.remove(path)
+        del self._scans[number]
+        with self._lock:
+            self._segments.remove(number)
+        log.info("compacted segment %d, %d waiting messages moved", number, len(live))
+        return True
+
+    def _path(self, number):
+        return os.path.join(self._directory, f"segment-{number:08d}.log")
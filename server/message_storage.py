@@ -1,13 +1,160 @@
 # in-memory storage for messages.
-# keys are recipient IDs (ASCII strings) and values are lists of message records.
+# every recipient ID (16 raw bytes) has a queue of waiting messages, each kept as its 2104 record
+# (sender id | message id | message type | content size | content) built once when it is sent,
+# so a fetch only concatenates them. a copy of an envelope (message type 6) is kept in two parts,
+# its own record head and the body shared by every copy (see record_parts).
+# message IDs are a sequence per recipient (1, 2, 3, ...): a fetch knows what it delivered by the last ID.
+# with a message log open, stores and deliveries are also written to disk (messageLog.py).
 
-import uuid
+import logging
+import struct
+import threading
+from collections import deque
+from messageLog import MessageLog
+from serverLog import get_logger
 
-MESSAGE_STORAGE = {}
+log = get_logger("message")
 
 
-def generate_message_id():
-    return int(uuid.uuid4().hex[:8], 16)
+class InboxStore:
+    """
+    waiting messages per recipient, sharded by recipient hash. every shard has its own lock and
+    maps recipient ID -> deque of 2104 records, so sends to recipients on different shards
+    never wait for each other. a fetch takes the whole queue out in one step under the shard
+    lock, a message stored meanwhile is either in that fetch or in the next one.
+    the shard also holds the last message ID given out per recipient; an ID is given out and its
+    record queued in the same step, so a queue is always in ID order and a fetch takes every
+    message up to its last ID.
+    with a message log, a record is queued to the log in that step instead and only goes into the
+    inbox once it is on disk (a failed write never reaches the recipient). the log completes its
+    writes in queue order, so records still arrive in ID order.
+    """
+
+    class _Shard:
+        __slots__ = ('lock', 'inboxes', 'last_ids')
+
+        def __init__(self):
+            self.lock = threading.Lock()
+            self.inboxes = {}
+            self.last_ids = {}
+
+    def __init__(self, shards=64):
+        self._shards = [self._Shard() for _ in range(shards)]
+
+    def _shard(self, recipient_id):
+        return self._shards[hash(recipient_id) % len(self._shards)]
+
+    def append(self, recipient_id, encode, message_log=None):
+        """
+        gives the message the recipient's next ID and queues encode(message_id), its 2104 record.
+        returns (message_id, commit): commit is the message log's future (None without a log).
+        """
+        shard = self._shard(recipient_id)
+        with shard.lock:
+            message_id = shard.last_ids.get(recipient_id, 0) + 1
+            record = encode(message_id)
+            shard.last_ids[recipient_id] = message_id
+            if message_log is None:
+                self._queue(shard, recipient_id, record)
+                return message_id, None
+
+            def committed(commit):
+                if commit.exception() is None:
+                    with shard.lock:
+                        self._queue(shard, recipient_id, record)
+
+            return message_id, message_log.append_store(recipient_id, record, committed)
+
+    @staticmethod
+    def _queue(shard, recipient_id, record):
+        # under shard.lock
+        inbox = shard.inboxes.get(recipient_id)
+        if inbox is None:
+            inbox = shard.inboxes[recipient_id] = deque()
+        inbox.append(record)
+
+    def restore(self, recipient_id, last_id, records):
+        """puts back a recipient's waiting records (in ID order) and last ID, e.g. from the message log."""
+        shard = self._shard(recipient_id)
+        with shard.lock:
+            shard.last_ids[recipient_id] = max(last_id, shard.last_ids.get(recipient_id, 0))
+            if records:
+                shard.inboxes.setdefault(recipient_id, deque()).extend(records)
+
+    def drain(self, recipient_id):
+        """removes and returns all waiting messages of the recipient, oldest first."""
+        shard = self._shard(recipient_id)
+        with shard.lock:
+            inbox = shard.inboxes.pop(recipient_id, None)
+        return list(inbox) if inbox else []
+
+    def count(self, recipient_id):
+        shard = self._shard(recipient_id)
+        with shard.lock:
+            return len(shard.inboxes.get(recipient_id, ()))
+
+    def clear(self):
+        for shard in self._shards:
+            with shard.lock:
+                shard.inboxes.clear()
+                shard.last_ids.clear()
+
+
+MESSAGE_STORAGE = InboxStore()
+
+# the fixed part of a 2104 record: sender id, message id, message type, content size
+MESSAGE_RECORD_HEADER = struct.Struct("!16s I B I")
+
+# None keeps messages in memory only
+MESSAGE_LOG = None
+
+
+def open_message_log(directory):
+    """
+    replays the message log in directory into MESSAGE_STORAGE and logs every store / delivery
+    from now on. returns the number of waiting messages recovered.
+    """
+    global MESSAGE_LOG
+    log = MessageLog(directory)
+    waiting, last_ids = log.open()
+    for recipient_id, last_id in last_ids.items():
+        MESSAGE_STORAGE.restore(recipient_id, last_id, waiting.get(recipient_id))
+    MESSAGE_LOG = log
+    return sum(len(records) for records in waiting.values())
+
+
+def close_message_log():
+    global MESSAGE_LOG
+    if MESSAGE_LOG is not None:
+        MESSAGE_LOG.close()
+        MESSAGE_LOG = None
+
+
+def encode_message_record(sender_id, message_id, message_type, content, shared=None):
+    """
+    the message as it goes out in a 2104 payload, content is copied once (any bytes-like object).
+    with shared, the content goes on with shared: the record is (head, shared) and shared is not copied.
+    """
+    if shared is None:
+        return MESSAGE_RECORD_HEADER.pack(sender_id, message_id, message_type, len(content)) + content
+    return (MESSAGE_RECORD_HEADER.pack(sender_id, message_id, message_type, len(content) + len(shared)) + content,
+            shared)
+
+
+def record_parts(records):
+    """the pieces of the 2104 payload of records, in order (a record in parts gives each of its parts)."""
+    parts = []
+    for record in records:
+        if isinstance(record, tuple):
+            parts.extend(record)
+        else:
+            parts.append(record)
+    return parts
+
+
+def record_message_id(record):
+    head = record[0] if isinstance(record, tuple) else record
+    return MESSAGE_RECORD_HEADER.unpack_from(head)[1]
 
 
 def decode_message_data(data):
@@ -15,25 +162,24 @@ def decode_message_data(data):
     decodes the raw message data.
 
     expected format of data:
-      - 16 bytes: recipient_id (ASCII, padded or truncated)
+      - 16 bytes: recipient_id (raw)
       - 1 byte: message_type (e.g., 3 for text)
       - 4 bytes: content_size (big-endian integer)
-      - n bytes: message_content (UTF-8 encoded)
+      - n bytes: message_content (raw bytes, ciphertext is not text)
 
     returns a dictionary with:
       - 'recipient_id'
       - 'message_type'
       - 'content_size'
-      - 'message_content'
+      - 'message_content' (a view of data, not copied)
 
     raises a ValueError if the data is incomplete.
     """
     if len(data) < 21:
         raise ValueError("Data too short for a valid message payload.")
 
-    # extract and decode the recipient ID.
-    recipient_id_bytes = data[:16]
-    recipient_id = recipient_id_bytes.decode('ascii', errors='ignore').rstrip('\0')
+    # extract the recipient ID (16 raw bytes).
+    recipient_id = bytes(data[:16])
 
     message_type = data[16]
 
@@ -43,9 +189,8 @@ def decode_message_data(data):
     if len(data) < 21 + content_size:
         raise ValueError(f"Incomplete message content: expected {21 + content_size} bytes, got {len(data)}")
 
-    # extract and decode the message content.
-    message_content_bytes = data[21:21+content_size]
-    message_content = message_content_bytes.decode('utf-8', errors='replace')
+    # extract the message content.
+    message_content = memoryview(data)[21:21+content_size]
 
     return {
         'recipient_id': recipient_id,
@@ -60,51 +205,58 @@ def save_to_message_storage(sender_id, data):
     Saves a message into MESSAGE_STORAGE.
 
     parameters:
-      - sender_id: The ID of the sender (string).
+      - sender_id: The ID of the sender (16 raw bytes).
       - data: Raw bytes of the message payload (format defined in decode_message_data).
 
-    function decodes the data, generates a new message ID, and creates a message record.
-    record is then saved in MESSAGE_STORAGE under the recipient's ID.
+    function decodes the data, gives it the recipient's next message ID, and creates the message's
+    2104 record. record is then saved in MESSAGE_STORAGE under the recipient's ID.
 
-    returns the message record (a dictionary).
+    returns (message_id, commit) as store_message does, (None, None) if nothing was saved.
     """
     try:
         # Decode the incoming message data.
         decoded = decode_message_data(data)
 
-        print("DEBUG: Saving message")   # --------------------------------------
-        print(f"Sender ID: {sender_id}")
-        print(f"Recipient ID: {decoded['recipient_id']}")
-        print(f"Message Content: {decoded['message_content']}")
-
-        # Generate a new message ID.
-        message_id = generate_message_id()
-
-        # Build a message record.
-        message_record = {
-            'sender_id': sender_id,
-            'message_id': message_id,
-            'recipient_id': decoded['recipient_id'],
-            'message': decoded['message_content'],
-            'message_type': decoded['message_type']
-        }
-
-        # Save the message record in storage.
-        if decoded['recipient_id'] not in MESSAGE_STORAGE:
-            MESSAGE_STORAGE[decoded['recipient_id']] = []
-        MESSAGE_STORAGE[decoded['recipient_id']].append(message_record)
-
-        print(f"DEBUG: Message saved for recipient {decoded['recipient_id']}")   # -------------
-        return message_record
+        if log.isEnabledFor(logging.DEBUG):
+            log.debug("Saving message from %s to %s, %d bytes", sender_id.hex(), decoded['recipient_id'].hex(),
+                      len(decoded['message_content']))
+
+        return store_message(sender_id, decoded['recipient_id'], decoded['message_type'], decoded['message_content'])
     except Exception as e:
-        print("Error saving message to storage:", e)
+        log.error("Error saving message to storage: %s", e)
+        return None, None
+
+
+def store_message(sender_id, recipient_id, message_type, content, shared=None):
+    """
+    creates the 2104 record of a message with the recipient's next message ID and saves it under
+    the recipient's ID. returns (message_id, commit): commit is a future that completes once the
+    record is in the message log (None without a log), the sender may only be told the message
+    is stored after that.
+    shared (bytes) is the rest of the content when several messages end the same way: it is kept
+    once for all of them, not copied into each record.
+    """
+    # the record is built exactly as a fetch sends it, with the ID given out under the shard lock.
+    # with a log the recipient sees it once it is on disk
+    message_id, commit = MESSAGE_STORAGE.append(
+        recipient_id, lambda message_id: encode_message_record(sender_id, message_id, message_type, content, shared),
+        MESSAGE_LOG)
+
+    log.debug("Message %d saved for recipient %s", message_id, recipient_id.hex())
+    return message_id, commit
 
 
 # retrieve messages for a given recipient.
 def get_messages_for_recipient(recipient_id):
     """
-    Returns a list of message records for the given recipient ID.
+    Returns the 2104 records of the messages waiting for the given recipient ID and removes
+    them from storage (fetch and drain in one step), record_parts gives their payload pieces.
+    with a message log they are tombstoned there.
     """
-    return MESSAGE_STORAGE.get(recipient_id, [])
+    messages = MESSAGE_STORAGE.drain(recipient_id)
+    if MESSAGE_LOG is not None and messages:
+        # one tombstone for everything up to the last ID fetched
+        MESSAGE_LOG.append_tombstone(recipient_id, record_message_id(messages[-1]))
+    return messages
 
 
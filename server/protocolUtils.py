@@ -1,7 +1,11 @@
 # binary protocol implementation
 
+import logging
 import struct
 from message_storage import *
+from serverLog import get_logger
+
+log = get_logger("protocol")
 '''
 ===================================
 decode packet arrived from client
@@ -9,35 +13,50 @@ decode packet arrived from client
 '''
 
 
-def decode_packet(data):
+HEADER_FORMAT = "!16s B H I"  # network order: 16-byte string, 1-byte, 2-byte, 4-byte
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)  # 16 + 1 + 2 + 4 = 23 bytes
+
+
+def decode_header(data):
     """
-    decodes a packet that contains:
-      - 16 bytes: client_id
+    decodes the 23 byte request header:
+      - 16 bytes: client_id (raw, kept as bytes)
       - 1 byte: version
       - 2 bytes: request code
       - 4 bytes: payload size
-    followed by the payload.
 
-    returns a tuple (header, payload) where header is a dictionary.
+    returns the header as a dictionary.
     """
-    header_format = "!16s B H I"  # network order: 16-byte string, 1-byte, 2-byte, 4-byte
-    header_size = struct.calcsize(header_format)  # should be 16 + 1 + 2 + 4 = 23 bytes
-
-    if len(data) < header_size:
-        print("Error: Packet too short to contain valid header.")
-        return None, None
-
-    client_id_bytes, version, request_code, payload_size = struct.unpack(header_format, data[:header_size])
-    header = {
-        "client_id": client_id_bytes.hex(),
+    client_id_bytes, version, request_code, payload_size = struct.unpack(HEADER_FORMAT, data[:HEADER_SIZE])
+    return {
+        "client_id": client_id_bytes,
         "version": version,
         "request_code": request_code,
         "payload_size": payload_size,
     }
-    payload = data[header_size:header_size + payload_size]
+
+
+def decode_packet(data):
+    """
+    decodes a complete packet (header followed by the payload).
+
+    returns a tuple (header, payload) where header is a dictionary.
+    """
+    if len(data) < HEADER_SIZE:
+        log.warning("Packet too short to contain valid header.")
+        return None, None
+
+    header = decode_header(data)
+    payload = data[HEADER_SIZE:HEADER_SIZE + header["payload_size"]]
     return header, payload
 
 
+class PayloadTooLarge(Exception):
+    def __init__(self, payload_size, max_payload_size):
+        super().__init__(f"request payload of {payload_size} bytes is over the limit of {max_payload_size}")
+        self.payload_size = payload_size
+
+
 '''
 ===================================
 processes for each request - includes payload decoding
@@ -53,29 +72,29 @@ def process_registration(payload, user_storage, user_manager):
       - 1 byte: name_length
       - n bytes: username (UTF-8)
       - 1 byte: public_key_length
-      - p bytes: public key (UTF-8, can be empty)
+      - p bytes: public key (opaque, can be empty). base64 text for RSA clients,
+        a suite tag byte + raw key for X25519 clients, so it is stored as bytes
     """
     if len(payload) < 1:
-        print("Error: Payload too short for registration.")
+        log.warning("Payload too short for registration.")
         return False, "Invalid payload"
 
     name_length = payload[0]
     if len(payload) < 1 + name_length + 1:
-        print("Error: Payload missing username or public key length.")
+        log.warning("Payload missing username or public key length.")
         return False, "Invalid payload"
-    username = payload[1:1 + name_length].decode('utf-8')
+    username = str(payload[1:1 + name_length], 'utf-8')
 
     pk_index = 1 + name_length
     public_key_length = payload[pk_index]
     if len(payload) < pk_index + 1 + public_key_length:
         public_key = None
     else:
-        public_key_raw = payload[pk_index + 1: pk_index + 1 + public_key_length]
-        public_key = public_key_raw.decode('utf-8')
-    print(f"Registration request for username: {username}")
+        public_key = bytes(payload[pk_index + 1: pk_index + 1 + public_key_length])
+    log.debug("Registration request for username: %s", username)
 
     if user_storage.username_exists(username):
-        print(f"Error: Username '{username}' already exists.")
+        log.warning("Username '%s' already exists.", username)
         return False, "Username already exists"
     else:
         return user_manager.register_user(username, public_key)
@@ -87,43 +106,78 @@ def process_message(user_id, payload):
     processes a messaging request payload.
 
     expected payload layout:
-      - 16 bytes: Recipient ID (ASCII)
+      - 16 bytes: Recipient ID (raw)
       - 1 byte: Message Type (expected to be 3 for text)
       - 4 bytes: Content size (big-endian)
-      - n bytes: Message Content (UTF-8 encoded)
+      - n bytes: Message Content (raw bytes, encrypted types are binary)
+
+    the content is returned as a view of payload, not copied: storing it makes the one copy.
     """
     try:
-        print(f"Processing message from {user_id}, payload length: {len(payload)}")
-        print(f"Payload bytes: {payload.hex()}")
+        if log.isEnabledFor(logging.DEBUG):
+            log.debug("Processing message from %s, payload length: %d", user_id.hex(), len(payload))
         # Check that the payload is at least 21 bytes (16+1+4)
         if len(payload) < 21:
             raise ValueError("Payload too short for processing message.")
 
-        # Extract recipient ID (first 16 bytes) and convert to ASCII, stripping trailing nulls.
-        recipient_id_bytes = payload[:16]
-        recipient_id = recipient_id_bytes.decode('ascii').rstrip('\0')
+        # Extract recipient ID (first 16 bytes), ids are binary and used as is
+        recipient_id = bytes(payload[:16])
 
         # Extract the message type (1 byte at index 16)
         message_type = payload[16]
 
         # Extract content size from the next 4 bytes (big-endian)
         content_size = int.from_bytes(payload[17:21], byteorder='big')
-        print(f"Parsed content_size: {content_size}")
+        log.debug("Parsed content_size: %d", content_size)
         # Ensure the payload contains the expected number of bytes for the message content.
         if len(payload) < 21 + content_size:
             raise ValueError("Incomplete payload: expected {} bytes of content, but got {}".format(21+content_size, len(payload)))
 
         # Extract the message content (starting at byte 21)
-        message_content_bytes = payload[21:21+content_size]
-        message_content = message_content_bytes.decode('utf-8')
+        message_content = memoryview(payload)[21:21+content_size]
 
         # Return the relevant values.
         return recipient_id, message_type, content_size, message_content
     except Exception as e:
-        print("Error processing message:", e)
+        log.warning("Error processing message: %s", e)
         return None, None, None, None
 
 
+MESSAGE_TYPE_ENVELOPE = 6
+
+
+def split_envelope(content):
+    """
+    splits the content of a message type 6 (one message for several recipients).
+
+    expected content layout:
+      - 2 bytes: recipient count (big-endian)
+      - per recipient: 16 bytes recipient ID | 2 bytes key size | wrapped key
+      - rest: encrypted body, shared by all recipients
+
+    returns (recipients, body) where recipients is a list of (recipient_id, wrapped_key).
+    raises a ValueError if the content is incomplete.
+    """
+    if len(content) < 2:
+        raise ValueError("Envelope too short.")
+    count = int.from_bytes(content[0:2], byteorder='big')
+    offset = 2
+    recipients = []
+    for _ in range(count):
+        if len(content) < offset + 18:
+            raise ValueError("Envelope recipient list is incomplete.")
+        recipient_id = bytes(content[offset:offset + 16])
+        key_size = int.from_bytes(content[offset + 16:offset + 18], byteorder='big')
+        offset += 18
+        if len(content) < offset + key_size:
+            raise ValueError("Envelope wrapped key is incomplete.")
+        recipients.append((recipient_id, content[offset:offset + key_size]))
+        offset += key_size
+    if not recipients:
+        raise ValueError("Envelope has no recipients.")
+    return recipients, content[offset:]
+
+
 '''
 ===================================
 response
@@ -173,72 +227,62 @@ def build_payload_registration_success(client_id):
     """
     The spec says that on registration success (code 2100),
     the payload contains the 16-byte client ID.
-    If 'client_id' is already a 16-byte value, just return it.
-    Otherwise, ensure it's exactly 16 bytes (e.g., pad or truncate).
+    ids are generated as 16 raw bytes, so it is sent as is.
     """
-    if isinstance(client_id, bytes) and len(client_id) == 16:
-        return client_id
+    if len(client_id) != 16:
+        raise ValueError("client id must be 16 bytes")
+    return bytes(client_id)
 
-    client_id_bytes = client_id.encode('utf-8')
-    # ensure exactly 16 bytes (pad or truncate as needed):
-    client_id_bytes = client_id_bytes[:16].ljust(16, b'\0')
-    return client_id_bytes
 
+USER_RECORD_SIZE = 16 + 255
 
-def build_users_payload(users_list):
+
+def encode_user_record(user_id, username):
     """
-    given a list of user dictionaries (with 'user_id' and 'username'),
-    builds a binary payload where each user record is:
-      - 16 bytes for the user_id (ASCII)
+    one record of the 2101 payload:
+      - 16 bytes for the user_id (raw)
       - 255 bytes for the username (ASCII)
-
-    returns a bytes object representing the payload.
     """
-    payload_bytes = bytearray()
+    # we use 254 bytes for characters then add null
+    uname_bytes = username.encode("ascii", errors="ignore")[:254]
+    uname_bytes += b'\0'
+    return bytes(user_id) + uname_bytes.ljust(255, b'\0')
 
-    for user in users_list:
-        # process the user ID (16 bytes)
-        uid = user.get("user_id", "")
-        uid_bytes = uid.encode("ascii", errors="ignore")[:16]
-        uid_bytes = uid_bytes.ljust(16, b'\0')
 
-        # process the username (255 bytes)
-        uname = user.get("username", "")
-        # we use 254 bytes for characters then add null
-        uname_bytes = uname.encode("ascii", errors="ignore")[:254]
-        uname_bytes += b'\0'
-        uname_bytes = uname_bytes.ljust(255, b'\0')
-
-        # append the two fields to the payload
-        payload_bytes.extend(uid_bytes)
-        payload_bytes.extend(uname_bytes)
+def build_users_payload(users_list):
+    """
+    given a list of user dictionaries (with 'user_id' and 'username'),
+    builds a binary payload of one record per user (see encode_user_record).
 
-    return bytes(payload_bytes)
+    returns a bytes object representing the payload.
+    """
+    return b''.join(encode_user_record(user.get("user_id", b'\0' * 16), user.get("username", ""))
+                    for user in users_list)
 
 def build_public_key_payload(user_id, public_key):
-    uid_bytes = user_id.encode('ascii')[:16].ljust(16, b'\0')
-    pub_key_bytes = public_key.encode('utf-8')
+    uid_bytes = bytes(user_id)
+    if public_key is None:
+        public_key = b''
+    # keys are kept as raw bytes since X25519 keys are not text
+    pub_key_bytes = public_key if isinstance(public_key, bytes) else public_key.encode('utf-8')
     return uid_bytes + pub_key_bytes
 
 
 
-# data are decoded recipient_id, message_type, content_size, message_content from process_message
+# data is the recipient and the message ID the message was stored with
 def build_message_payload(data):
     """
-    given a tuple (recipient_id, message_type, content_size, message_content),
+    given a tuple (recipient_id, message_id),
     build a binary payload with the following layout:
-      - 16 bytes: recipient_id (ASCII, padded/truncated)
+      - 16 bytes: recipient_id (raw)
       - 4 bytes: message_id
 
     returns the payload as bytes.
     """
-    recipient_id, message_type, content_size, message_content = data
+    recipient_id, message_id = data
 
-    # ensure recipient_id is exactly 16 characters: truncate or pad with '\0'
-    recipient_fixed = recipient_id[:16].ljust(16, '\0')
-    recipient_bytes = recipient_fixed.encode('ascii', errors='ignore')
+    recipient_bytes = bytes(recipient_id)
 
-    message_id = generate_message_id()
     message_id_bytes = message_id.to_bytes(4, byteorder='big', signed=False)
 
     payload_bytes = recipient_bytes + message_id_bytes
@@ -254,22 +298,9 @@ def build_pull_messages_payload(messages):
       - 1 byte: message type
       - 4 bytes: content size
       - content_size bytes: message content
+    messages are stored in exactly this form (message_storage.py), so it is a concatenation.
     """
-    payload = bytearray()
-    for msg in messages:
-        sender_id = msg['sender_id'][:16].ljust(16, '\0').encode('ascii')
-        message_id_bytes = msg['message_id'].to_bytes(4, byteorder='big')
-        message_type = msg['message_type'].to_bytes(1, byteorder='big')
-        content_bytes = msg['message'].encode('utf-8')
-        content_size = len(content_bytes).to_bytes(4, byteorder='big')
-
-        payload.extend(sender_id)
-        payload.extend(message_id_bytes)
-        payload.extend(message_type)
-        payload.extend(content_size)
-        payload.extend(content_bytes)
-
-    payload_bytes = bytes(payload)
-    print(f"Built pull messages payload of size: {len(payload_bytes)} bytes")
+    payload_bytes = b''.join(messages)
+    log.debug("Built pull messages payload of size: %d bytes", len(payload_bytes))
     return payload_bytes
 
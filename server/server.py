@@ -1,41 +1,201 @@
-
 # sets up a TCP server that listens for incoming client connections on a specified port
-# each connection is handled in a separate thread
-# passing it to handle_client along with user management and storage objects
+# all connections are multiplexed on one asyncio event loop: each connection reads its request
+# (23 byte header, then exactly payload_size bytes), passes it to process_request along with
+# user management and storage objects, writes the response and closes.
+# handlers that grow with the number of users / messages can run on a bounded worker pool
+# waiting messages are kept in a message log (messageLog.py) and recovered from it on startup,
+# users in an sqlite database (userDatabase.py)
 
-import socket
-import threading
-from messageHandler import handle_client
-from config import get_port  # config is a file, get_port is the func we will use or can do * for getting all func
+import asyncio
+from concurrent.futures import ThreadPoolExecutor
+from serverLog import get_logger, setup_logging, stop_logging
+from messageHandler import handle_request, build_response, send_response
+from message_storage import open_message_log, close_message_log
+from protocolUtils import HEADER_SIZE, PayloadTooLarge, decode_header
+from config import get_port, get_max_payload_size, get_backlog, get_workers, get_message_log, get_user_database, get_log_level, get_log_samples  # config is a file, get_port is the func we will use or can do * for getting all func
 from userStorage import UserStorage
+from userDatabase import DatabaseUserStorage
 from userManager import UserManager
 
 
-def start_server(host, port):
-    # initialize storage and user manager
-    user_storage = UserStorage()
-    user_manager = UserManager(user_storage)
+# requests that go to the worker pool when there is one: 601 (users list) and 604 (waiting messages)
+HEAVY_REQUEST_CODES = {601, 604}
+
+# a connection that has not sent a whole request by then is dropped
+REQUEST_TIMEOUT = 30
+
+log = get_logger("server")
+
+# directory of the message log segments
+MESSAGE_LOG_DIR = "message_log"
+
+# database file of the registered users
+USER_DATABASE = "users.db"
+
+
+class ResponseBuffer:
+    """
+    stands in for the socket while a request is processed: send_response calls sendall,
+    the event loop writes what was collected once the handler returns (handlers on the
+    worker pool must not touch the transport). data is kept as it is, not copied: responses
+    are bytes or views of immutable buffers (the users directory).
+    a response can be held until message log / user database writes are on disk (hold_until),
+    the handler returns right away and the connection is answered when the group commit completes.
+    """
+
+    def __init__(self):
+        self.chunks = []
+        self.holds = []
+
+    def sendall(self, data):
+        self.chunks.append(data)
+
+    def hold_until(self, commit):
+        self.holds.append(commit)
+
+
+class RequestProtocol(asyncio.BufferedProtocol):
+    """
+    one client connection. the transport receives straight into the connection's buffer
+    (get_buffer / buffer_updated), first the header, then exactly the payload. a connection
+    only holds the header until it is known, the payload buffer has exactly payload_size bytes.
+    """
+
+    def __init__(self, server):
+        self._server = server
+        self._transport = None
+        self._timeout = None
+        self._buffer = bytearray(HEADER_SIZE)
+        self._filled = 0
+        self._needed = HEADER_SIZE
+        self._header = None
+        self._done = False
+
+    def connection_made(self, transport):
+        self._transport = transport
+        self._timeout = self._server.loop.call_later(REQUEST_TIMEOUT, transport.abort)
+
+    def connection_lost(self, exc):
+        self._timeout.cancel()
+
+    def get_buffer(self, sizehint):
+        if self._done:
+            return memoryview(bytearray(1))  # reading is paused, nothing more is expected
+        return memoryview(self._buffer)[self._filled:self._needed]
+
+    def buffer_updated(self, nbytes):
+        if self._done:
+            return
+        self._filled += nbytes
+        if self._filled < self._needed:
+            return
+        if self._header is None:
+            self._header = decode_header(self._buffer)
+            payload_size = self._header["payload_size"]
+            if payload_size > self._server.max_payload_size:
+                log.warning("%s", PayloadTooLarge(payload_size, self._server.max_payload_size))
+                response = ResponseBuffer()
+                send_response(response, build_response(1, 9000))
+                self._done = True
+                self._finish(response)
+                return
+            self._buffer = bytearray(payload_size)
+            self._filled = 0
+            self._needed = payload_size
+            if payload_size > 0:
+                return
+        self._dispatch(memoryview(self._buffer)[:self._needed])
+
+    def eof_received(self):
+        if self._header is None and self._filled == 0:
+            log.debug("no data received")
+        else:
+            log.warning("Error handling client: connection closed inside a request")
+        return False  # close the transport
+
+    def _dispatch(self, payload):
+        # one request per connection
+        self._done = True
+        self._transport.pause_reading()
+        self._timeout.cancel()
+
+        server = self._server
+        response = ResponseBuffer()
+        args = (self._header, payload, response, server.user_storage, server.user_manager)
+        if server.pool is not None and self._header["request_code"] in HEAVY_REQUEST_CODES:
+            future = server.loop.run_in_executor(server.pool, handle_request, *args)
+            future.add_done_callback(lambda _: self._finish(response))
+        else:
+            handle_request(*args)
+            self._finish(response)
+
+    def _finish(self, response):
+        if response.holds:
+            waits = [asyncio.wrap_future(commit, loop=self._server.loop) for commit in response.holds]
+            response.holds = []
+            done = asyncio.gather(*waits, return_exceptions=True)
+            done.add_done_callback(lambda _: self._committed(response, done.result()))
+            return
+        if self._transport.is_closing():
+            return  # client went away meanwhile
+        self._transport.writelines(response.chunks)
+        self._transport.close()  # after the response is written
+
+    def _committed(self, response, results):
+        errors = [result for result in results if isinstance(result, BaseException)]
+        if errors:
+            # not stored, the client must not get its 2100 / 2103
+            log.error("Error handling client: write failed: %s", errors[0])
+            response.chunks = []
+            send_response(response, build_response(1, 9000))
+        self._finish(response)
+
+
+class Server:
+    def __init__(self, max_payload_size, workers, message_log=True, user_database=True):
+        # initialize storage and user manager
+        self.user_storage = DatabaseUserStorage(USER_DATABASE) if user_database else UserStorage()
+        self.user_manager = UserManager(self.user_storage)
+        self.max_payload_size = max_payload_size
+        self.pool = ThreadPoolExecutor(max_workers=workers) if workers > 0 else None
+        self.loop = None
+        if message_log:
+            recovered = open_message_log(MESSAGE_LOG_DIR)
+            log.info("%d waiting messages recovered from the message log", recovered)
 
-    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    s.bind((host, port))
-    s.listen(5)
-    print(f"Server listening on {host}:{port}")
+    async def serve(self, host, port, backlog):
+        self.loop = asyncio.get_running_loop()
+        server = await self.loop.create_server(lambda: RequestProtocol(self), host, port, backlog=backlog)
+        log.info("Server listening on %s:%d", host, port)
+        async with server:
+            await server.serve_forever()
 
-    while True:
-        conn, addr = s.accept()
-        print(f"Connection from {addr}\n")
 
-        # new thread to handle the client connection
-        client_thread = threading.Thread(target=handle_client, args=(conn, user_storage, user_manager))
-        client_thread.start()
-        print("server is ready")
+def start_server(host, port, max_payload_size, backlog=1024, workers=0, message_log=True, user_database=True):
+    server = Server(max_payload_size, workers, message_log, user_database)
+    try:
+        asyncio.run(server.serve(host, port, backlog))
+    finally:
+        if server.pool is not None:
+            server.pool.shutdown(wait=False)
+        close_message_log()
+        server.user_storage.close()
 
 
 def main():
-    host = "127.0.0.1" 
+    setup_logging(get_log_level('myport.info'), get_log_samples('myport.info'))
+    host = "127.0.0.1"
     port = get_port('myport.info')
+    max_payload_size = get_max_payload_size('myport.info')
+    backlog = get_backlog('myport.info')
+    workers = get_workers('myport.info')
+    message_log = get_message_log('myport.info')
+    user_database = get_user_database('myport.info')
 
-    start_server(host, port)
+    try:
+        start_server(host, port, max_payload_size, backlog, workers, message_log, user_database)
+    finally:
+        stop_logging()
 
 
 if __name__ == "__main__":
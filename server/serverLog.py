@@ -0,0 +1,96 @@
+# leveled logging for the server, written out by a background thread.
+# every module logs to its own category (logger "server.<category>"). per-request details are
+# DEBUG, off by default: a disabled call is one level check, its arguments are never formatted.
+# records below WARNING can be sampled per category, warnings and errors always get through.
+
+import itertools
+import logging
+import logging.handlers
+import queue
+import sys
+
+
+LOG_FORMAT = "%(asctime)s %(levelname)s [%(name)s] %(message)s"
+
+# records waiting for the writer thread, more are dropped (and counted) instead of blocking a request
+QUEUE_SIZE = 10000
+
+_listener = None
+_handler = None
+
+
+def get_logger(category):
+    return logging.getLogger("server." + category)
+
+
+class SampleFilter(logging.Filter):
+    """keeps 1 of every n records below WARNING of a category, rates is {category: n}."""
+
+    def __init__(self, rates):
+        super().__init__()
+        self._rates = dict(rates)
+        self._counters = {category: itertools.count() for category in self._rates}
+
+    def filter(self, record):
+        if record.levelno >= logging.WARNING:
+            return True
+        category = record.name[len("server."):]
+        counter = self._counters.get(category)
+        return counter is None or next(counter) % self._rates[category] == 0
+
+
+class QueueHandler(logging.handlers.QueueHandler):
+    """
+    hands records to the writer thread as they are: the message is formatted there, not on the
+    request path. never blocks, a full queue drops the record.
+    """
+
+    def __init__(self, records):
+        super().__init__(records)
+        self.dropped = 0
+
+    def prepare(self, record):
+        return record
+
+    def enqueue(self, record):
+        try:
+            self.queue.put_nowait(record)
+        except queue.Full:
+            self.dropped += 1
+
+
+def setup_logging(level=logging.INFO, samples=None, stream=None):
+    """
+    sends the "server" loggers to stream (stdout) through the writer thread.
+    level - the lowest level written (logging.DEBUG brings back the per-request output).
+    samples - {category: n}, keep 1 of n records below WARNING of that category.
+    """
+    global _listener, _handler
+    stop_logging()
+    output = logging.StreamHandler(stream if stream is not None else sys.stdout)
+    output.setFormatter(logging.Formatter(LOG_FORMAT))
+
+    records = queue.Queue(QUEUE_SIZE)
+    _handler = QueueHandler(records)
+    if samples:
+        _handler.addFilter(SampleFilter(samples))
+
+    root = logging.getLogger("server")
+    root.setLevel(level)
+    root.propagate = False
+    root.handlers = [_handler]
+    _listener = logging.handlers.QueueListener(records, output)
+    _listener.start()
+
+
+def stop_logging():
+    """writes what is still queued and stops the writer thread."""
+    global _listener, _handler
+    if _listener is None:
+        return
+    _listener.stop()
+    if _handler.dropped:
+        print(f"Logging: {_handler.dropped} records dropped (queue full)", file=sys.stderr)
+    logging.getLogger("server").handlers = []
+    _listener = None
+    _handler = None
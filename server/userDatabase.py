@@ -0,0 +1,151 @@
+# user storage kept in an sqlite database, so registrations survive a restart.
+# same interface as UserStorage: the users are all loaded into its in-memory indexes on startup
+# and every lookup is served from there, the database only takes the writes.
+
+import sqlite3
+import threading
+from concurrent.futures import Future
+from itertools import groupby
+from userStorage import UserStorage
+from serverLog import get_logger
+
+log = get_logger("user_db")
+
+
+INSERT_USER = "INSERT OR REPLACE INTO users (user_id, username, public_key) VALUES (?, ?, ?)"
+DELETE_USER = "DELETE FROM users WHERE user_id = ?"
+DELETE_ALL_USERS = "DELETE FROM users"
+
+
+class DatabaseUserStorage(UserStorage):
+    """
+    sqlite in WAL mode, users in registration order (seq) with unique indexes on user_id and username.
+    writes are queued in the order they were applied in memory; one writer thread commits everything
+    queued meanwhile as one transaction (runs of inserts as one executemany), so a burst of
+    registrations costs one fsync. pending_commit() tells when the writes so far are on disk.
+    a transaction that fails is taken back out of memory (and the users directory) too.
+    """
+
+    def __init__(self, path):
+        super().__init__()
+        self._path = path
+        self._writes_lock = threading.Lock()   # memory and queue are changed together, in the same order
+        self._wakeup = threading.Condition(threading.Lock())
+        self._writes = []                      # (sql, params, undo)
+        self._commit = None                    # future of the writes in self._writes
+        self._last_commit = None               # future of the last batch queued (maybe being written)
+        self._closing = False
+
+        connection = self._connect()
+        with connection:
+            connection.execute("CREATE TABLE IF NOT EXISTS users ("
+                               "seq INTEGER PRIMARY KEY, "
+                               "user_id BLOB NOT NULL UNIQUE, "
+                               "username TEXT NOT NULL UNIQUE, "
+                               "public_key BLOB)")
+        self._load(connection)
+        connection.close()
+
+        self._writer = threading.Thread(target=self._write_loop, name="user-db-writer", daemon=True)
+        self._writer.start()
+
+    def _connect(self):
+        connection = sqlite3.connect(self._path, check_same_thread=False)
+        connection.execute("PRAGMA journal_mode=WAL")
+        connection.execute("PRAGMA synchronous=FULL")  # a committed registration is on disk
+        return connection
+
+    def _load(self, connection):
+        # warm cache: one scan fills both indexes, the users directory is encoded right away so the
+        # first 601 does not stall the server
+        by_id = {}
+        by_name = {}
+        for user_id, username, public_key in connection.execute(
+                "SELECT user_id, username, public_key FROM users ORDER BY seq"):
+            user_data = {'user_id': user_id, 'username': username, 'public_key': public_key}
+            by_id[user_id] = user_data
+            by_name[username] = user_data
+        with self._lock:
+            self._by_id = by_id
+            self._by_name = by_name
+            self._rebuild_directory()
+        log.info("%d users loaded from %s", len(by_id), self._path)
+
+    '''
+    ===================================
+    writes
+    ===================================
+    '''
+
+    def save_user_data(self, user_data):
+        with self._writes_lock:
+            super().save_user_data(user_data)
+            self._queue(INSERT_USER, (user_data['user_id'], user_data['username'], user_data['public_key']),
+                        lambda: UserStorage.remove_user(self, user_data['user_id']))
+
+    def remove_user(self, user_id):
+        with self._writes_lock:
+            user_data = self.get_user_by_id(user_id)
+            super().remove_user(user_id)
+            self._queue(DELETE_USER, (user_id,), lambda: self._restore([user_data] if user_data else []))
+
+    def clear_all_users(self):
+        with self._writes_lock:
+            users = self.load_user_data()
+            super().clear_all_users()
+            self._queue(DELETE_ALL_USERS, (), lambda: self._restore(users))
+
+    def pending_commit(self):
+        with self._wakeup:
+            commit = self._last_commit
+        if commit is None or (commit.done() and commit.exception() is None):
+            return None
+        return commit
+
+    def close(self):
+        with self._wakeup:
+            self._closing = True
+            self._wakeup.notify()
+        self._writer.join()
+
+    def _queue(self, sql, params, undo):
+        # undo() takes the change back out of memory if the write fails
+        with self._wakeup:
+            if self._commit is None:
+                self._commit = self._last_commit = Future()
+            self._writes.append((sql, params, undo))
+            if len(self._writes) == 1:
+                self._wakeup.notify()
+
+    def _write_loop(self):
+        connection = self._connect()
+        while True:
+            with self._wakeup:
+                while not self._writes and not self._closing:
+                    self._wakeup.wait()
+                if not self._writes:
+                    break
+                writes, self._writes = self._writes, []
+                commit, self._commit = self._commit, None
+            try:
+                with connection:  # one transaction
+                    for sql, batch in groupby(writes, key=lambda write: write[0]):
+                        connection.executemany(sql, [params for _, params, _ in batch])
+                commit.set_result(None)
+            except sqlite3.Error as e:
+                log.error("write failed: %s", e)
+                self._undo(writes)
+                commit.set_exception(e)
+        connection.close()
+
+    def _undo(self, writes):
+        # writer thread: the transaction was rolled back, so memory goes back to what the database
+        # holds before anyone is told (the username of a failed registration is free again)
+        with self._writes_lock:
+            for _, _, undo in reversed(writes):
+                undo()
+        log.warning("%d user changes taken back", len(writes))
+
+    def _restore(self, users):
+        for user_data in users:
+            UserStorage.save_user_data(self, user_data)
@@ -4,6 +4,9 @@
 
 import uuid
 from userStorage import *
+from serverLog import get_logger
+
+log = get_logger("user")
 class UserManager:
     def __init__(self, user_storage):
         # Takes an instance of UserStorage
@@ -11,14 +14,15 @@ class UserManager:
 
     def register_user(self, username, public_key):
         """registers a new user by generating a user_id and storing in UserStorage."""
-        user_id = uuid.uuid4().hex[:16]
+        # ids are 16 raw bytes, the same form the client keeps them in
+        user_id = uuid.uuid4().bytes
         user_data = {
             'user_id': user_id,
             'username': username,
             'public_key': public_key if public_key else None,
         }
         self.user_storage.save_user_data(user_data)
-        print(f"User '{username}' registered with ID {user_id}.")
+        log.info("User '%s' registered with ID %s.", username, user_id.hex())
         return True, user_id
 '''
     def authenticate_user(self, user_id):
@@ -2,39 +2,116 @@
 # store users info: id, user name and public key  in RAM memory
 # user_data contains: user name, id and public key
 
+import threading
+from protocolUtils import USER_RECORD_SIZE, encode_user_record
+
+# records per chunk of the pre-encoded users directory
+DIRECTORY_CHUNK_RECORDS = 1024
+
+
 class UserStorage:
     def __init__(self):
-        self.users = []  # list to store user data as dictionaries
+        # users by id (dicts keep insertion order, so this is also the registration order)
+        # and by username, both point to the same user data dictionaries
+        self._by_id = {}
+        self._by_name = {}
+        self._lock = threading.Lock()  # writers and the directory, lookups are single dict reads
+
+        # the 2101 payload, pre-encoded: full chunks of DIRECTORY_CHUNK_RECORDS records (immutable),
+        # the records after them (appended to by registrations, frozen into bytes once per change
+        # when a 601 needs them) and the record index of every user.
+        # _directory is None when everything has to be rebuilt
+        self._directory = []
+        self._directory_tail = bytearray()
+        self._frozen_tail = b''
+        self._directory_index = {}
 
     def save_user_data(self, user_data):
         """store user data in-memory."""
-        self.users.append(user_data)  # add user data to the in-memory list
+        with self._lock:
+            self._by_id[user_data['user_id']] = user_data
+            self._by_name[user_data['username']] = user_data
+            if self._directory is not None:
+                self._append_to_directory(user_data)
 
     def load_user_data(self):
         """return all user data stored in memory."""
-        return self.users
+        return list(self._by_id.values())
 
     def get_user_by_id(self, user_id):
         """retrieve user data by user_id."""
-        for user in self.users:
-            if user['user_id'] == user_id:
-                return user
-        return None  # return None if user is not found
+        return self._by_id.get(user_id)  # None if user is not found
 
     def username_exists(self, username):
         """check if the username already exists in storage."""
-        for user in self.users:
-            if user['username'] == username:
-                return True
-        return False  # return False if username is not found
+        return username in self._by_name
 
     def remove_user(self, user_id):
-        """remove a user from the in-memory list by user ID."""
-        self.users = [user for user in self.users if user['user_id'] != user_id]
+        """remove a user from memory by user ID."""
+        with self._lock:
+            user = self._by_id.pop(user_id, None)
+            if user is not None and self._by_name.get(user['username']) is user:
+                del self._by_name[user['username']]
+            if user is not None:
+                self._directory = None  # rare, rebuilt by the next 601
 
     def clear_all_users(self):
         """clear all user data from memory."""
-        self.users.clear()
+        with self._lock:
+            self._by_id.clear()
+            self._by_name.clear()
+            self._directory = []
+            self._directory_tail = bytearray()
+            self._frozen_tail = b''
+            self._directory_index = {}
+
+    def pending_commit(self):
+        """a future that completes once the changes so far are persisted, None if nothing is pending (memory only)."""
+        return None
+
+    def close(self):
+        pass
+
+    def directory_payload(self, exclude_id=None):
+        """
+        the 2101 payload as a list of byte strings / memoryviews, meant to be written without
+        joining them. the record of exclude_id (the requester) is cut out by slicing its chunk.
+        """
+        with self._lock:
+            # a rebuild runs under the lock, concurrent 601s wait for it and share the result
+            if self._directory is None:
+                self._rebuild_directory()
+            if self._frozen_tail is None:
+                self._frozen_tail = bytes(self._directory_tail)
+            chunks = self._directory + [self._frozen_tail]
+            index = self._directory_index.get(exclude_id)
+        if index is None:
+            return chunks
+        chunk_number, record = divmod(index, DIRECTORY_CHUNK_RECORDS)
+        chunk = memoryview(chunks[chunk_number])
+        start = record * USER_RECORD_SIZE
+        return (chunks[:chunk_number] + [chunk[:start], chunk[start + USER_RECORD_SIZE:]]
+                + chunks[chunk_number + 1:])
+
+    def _append_to_directory(self, user_data):
+        # a registration encodes its own record only, chunks already handed out stay untouched
+        self._directory_index[user_data['user_id']] = len(self._directory_index)
+        self._directory_tail += encode_user_record(user_data['user_id'], user_data['username'])
+        if len(self._directory_tail) == DIRECTORY_CHUNK_RECORDS * USER_RECORD_SIZE:
+            self._directory.append(bytes(self._directory_tail))
+            self._directory_tail = bytearray()
+        self._frozen_tail = None
+
+    def _rebuild_directory(self):
+        users = list(self._by_id.values())
+        full = len(users) - len(users) % DIRECTORY_CHUNK_RECORDS
+        self._directory_index = {user['user_id']: i for i, user in enumerate(users)}
+        self._directory = [b''.join(encode_user_record(user['user_id'], user['username'])
+                                    for user in users[i:i + DIRECTORY_CHUNK_RECORDS])
+                           for i in range(0, full, DIRECTORY_CHUNK_RECORDS)]
+        self._directory_tail = bytearray(b''.join(encode_user_record(user['user_id'], user['username'])
+                                                  for user in users[full:]))
+        self._frozen_tail = None
 
 
 